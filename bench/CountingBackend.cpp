@@ -0,0 +1,129 @@
+#include "CountingBackend.h"
+
+using namespace std;
+
+static const char *operationNames[CountingBackend::NUM_OPERATIONS] = { "stat",
+		"open", "close", "read", "write", "truncate", "read_link", "symlink",
+		"mkdir", "set_attributes", "remove", "list" };
+
+CountingBackend::CountingBackend(IoBackend *underlying) :
+		underlying(underlying) {
+	for (atomic<uint64_t> &count : counts)
+		count = 0;
+}
+
+const char* CountingBackend::Name(Operation operation) {
+	return operationNames[operation];
+}
+
+CountingBackend::Counts CountingBackend::Get() const {
+	Counts result;
+	for (size_t o = 0; o < NUM_OPERATIONS; o++)
+		result[o] = counts[o];
+	return result;
+}
+
+int CountingBackend::Stat(const DirHandle *dir, const string &name,
+		struct stat *buf, unsigned int mask) {
+	counts[STAT]++;
+	return underlying->Stat(dir, name, buf, mask);
+}
+
+int CountingBackend::Fstat(int fd, struct stat *buf, unsigned int mask) {
+	counts[STAT]++;
+	return underlying->Fstat(fd, buf, mask);
+}
+
+int CountingBackend::Open(const DirHandle *dir, const string &name, int flags,
+		mode_t mode) {
+	counts[OPEN]++;
+	return underlying->Open(dir, name, flags, mode);
+}
+
+int CountingBackend::Close(int fd) {
+	counts[CLOSE]++;
+	return underlying->Close(fd);
+}
+
+ssize_t CountingBackend::Pread(int fd, void *buf, size_t count, off_t offset) {
+	counts[READ]++;
+	return underlying->Pread(fd, buf, count, offset);
+}
+
+ssize_t CountingBackend::Write(int fd, const void *buf, size_t count) {
+	counts[WRITE]++;
+	return underlying->Write(fd, buf, count);
+}
+
+ssize_t CountingBackend::Pwrite(int fd, const void *buf, size_t count,
+		off_t offset) {
+	counts[WRITE]++;
+	return underlying->Pwrite(fd, buf, count, offset);
+}
+
+int CountingBackend::Truncate(int fd, off_t length) {
+	counts[TRUNCATE]++;
+	return underlying->Truncate(fd, length);
+}
+
+ssize_t CountingBackend::ReadLink(const DirHandle *dir, const string &name,
+		char *buf, size_t size) {
+	counts[READ_LINK]++;
+	return underlying->ReadLink(dir, name, buf, size);
+}
+
+int CountingBackend::Symlink(const char *target, const DirHandle *dir,
+		const string &name) {
+	counts[SYMLINK]++;
+	return underlying->Symlink(target, dir, name);
+}
+
+int CountingBackend::Mkdir(const DirHandle *dir, const string &name,
+		mode_t mode) {
+	counts[MKDIR]++;
+	return underlying->Mkdir(dir, name, mode);
+}
+
+int CountingBackend::SetTimes(const DirHandle *dir, const string &name,
+		const struct timespec times[2]) {
+	counts[SET_ATTRIBUTES]++;
+	return underlying->SetTimes(dir, name, times);
+}
+
+int CountingBackend::Chown(const DirHandle *dir, const string &name,
+		uid_t uid, gid_t gid) {
+	counts[SET_ATTRIBUTES]++;
+	return underlying->Chown(dir, name, uid, gid);
+}
+
+int CountingBackend::Chmod(const DirHandle *dir, const string &name,
+		mode_t mode) {
+	counts[SET_ATTRIBUTES]++;
+	return underlying->Chmod(dir, name, mode);
+}
+
+int CountingBackend::Futimens(int fd, const struct timespec times[2]) {
+	counts[SET_ATTRIBUTES]++;
+	return underlying->Futimens(fd, times);
+}
+
+int CountingBackend::Fchown(int fd, uid_t uid, gid_t gid) {
+	counts[SET_ATTRIBUTES]++;
+	return underlying->Fchown(fd, uid, gid);
+}
+
+int CountingBackend::Fchmod(int fd, mode_t mode) {
+	counts[SET_ATTRIBUTES]++;
+	return underlying->Fchmod(fd, mode);
+}
+
+bool CountingBackend::RemoveAll(const DirHandle *dir, const string &name) {
+	counts[REMOVE]++;
+	return underlying->RemoveAll(dir, name);
+}
+
+bool CountingBackend::ListDirectory(const DirHandle &dir,
+		vector<string> &names) {
+	counts[LIST]++;
+	return underlying->ListDirectory(dir, names);
+}
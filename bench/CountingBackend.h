@@ -0,0 +1,82 @@
+#ifndef BENCH_COUNTINGBACKEND_H_
+#define BENCH_COUNTINGBACKEND_H_
+
+#include "IoBackend.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Backend that counts the operations fastsync issues, by kind, before
+ * passing them to an underlying backend. Unlike /proc/self/io, this also
+ * covers metadata operations.
+ */
+class CountingBackend: public IoBackend {
+public:
+	enum Operation {
+		STAT,
+		OPEN,
+		CLOSE,
+		READ,
+		WRITE,
+		TRUNCATE,
+		READ_LINK,
+		SYMLINK,
+		MKDIR,
+		/// Timestamps, owner and mode, by name or by descriptor.
+		SET_ATTRIBUTES,
+		REMOVE,
+		LIST,
+		NUM_OPERATIONS
+	};
+
+	typedef std::array<uint64_t, NUM_OPERATIONS> Counts;
+
+	explicit CountingBackend(IoBackend *underlying);
+
+	/// Name of an operation for the output, e.g. "stat".
+	static const char* Name(Operation operation);
+
+	/// Current counts of this instance.
+	Counts Get() const;
+
+	int Stat(const DirHandle *dir, const std::string &name, struct stat *buf,
+			unsigned int mask = StatMaskAttributes) override;
+	int Fstat(int fd, struct stat *buf, unsigned int mask = StatMaskAttributes)
+			override;
+	int Open(const DirHandle *dir, const std::string &name, int flags,
+			mode_t mode = 0) override;
+	int Close(int fd) override;
+	ssize_t Pread(int fd, void *buf, size_t count, off_t offset) override;
+	ssize_t Write(int fd, const void *buf, size_t count) override;
+	ssize_t Pwrite(int fd, const void *buf, size_t count, off_t offset)
+			override;
+	int Truncate(int fd, off_t length) override;
+	ssize_t ReadLink(const DirHandle *dir, const std::string &name, char *buf,
+			size_t size) override;
+	int Symlink(const char *target, const DirHandle *dir,
+			const std::string &name) override;
+	int Mkdir(const DirHandle *dir, const std::string &name, mode_t mode)
+			override;
+	int SetTimes(const DirHandle *dir, const std::string &name,
+			const struct timespec times[2]) override;
+	int Chown(const DirHandle *dir, const std::string &name, uid_t uid,
+			gid_t gid) override;
+	int Chmod(const DirHandle *dir, const std::string &name, mode_t mode)
+			override;
+	int Futimens(int fd, const struct timespec times[2]) override;
+	int Fchown(int fd, uid_t uid, gid_t gid) override;
+	int Fchmod(int fd, mode_t mode) override;
+	bool RemoveAll(const DirHandle *dir, const std::string &name) override;
+	bool ListDirectory(const DirHandle &dir, std::vector<std::string> &names)
+			override;
+
+private:
+	IoBackend *underlying;
+	std::atomic<uint64_t> counts[NUM_OPERATIONS];
+};
+
+#endif /* BENCH_COUNTINGBACKEND_H_ */
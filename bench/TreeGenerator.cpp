@@ -0,0 +1,193 @@
+#include "TreeGenerator.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+using namespace std;
+
+static const size_t patternSize = 1024 * 1024;
+
+TreeGenerator::TreeGenerator(uint64_t seed, double scale) :
+		random(seed), scale(scale), pattern(patternSize), baseTime(
+				1500000000) {
+	for (size_t i = 0; i < patternSize; i += sizeof(uint64_t)) {
+		uint64_t value = random();
+		copy((char*) &value, (char*) &value + sizeof(value), &pattern[i]);
+	}
+}
+
+vector<string> TreeGenerator::Scenarios() {
+	return {"tiny", "wide", "deep", "huge", "mixed", "symlinks", "incremental"};
+}
+
+size_t TreeGenerator::scaled(size_t count) const {
+	return max((size_t) 1, (size_t) (count * scale));
+}
+
+uint64_t TreeGenerator::uniform(uint64_t min, uint64_t max) {
+	return uniform_int_distribution<uint64_t>(min, max)(random);
+}
+
+void TreeGenerator::writeFile(const filesystem::path &path, uint64_t size) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	// Contents are cut from the pattern at a random position
+	size_t offset = uniform(0, patternSize - 1);
+	while (size > 0) {
+		size_t piece = min((uint64_t) (patternSize - offset), size);
+		if (write(fd, &pattern[offset], piece) <= 0)
+			break;
+		size -= piece;
+		offset = 0;
+	}
+	close(fd);
+	setTime(path, baseTime);
+}
+
+void TreeGenerator::setTime(const filesystem::path &path, int64_t time) {
+	struct timespec times[2];
+	times[0].tv_sec = time;
+	times[0].tv_nsec = 0;
+	times[1] = times[0];
+	utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW);
+}
+
+void TreeGenerator::fixDirectoryTimes(const filesystem::path &root) {
+	vector<filesystem::path> directories = { root };
+	for (const auto &entry : filesystem::recursive_directory_iterator(root))
+		if (entry.is_directory() && !entry.is_symlink())
+			directories.push_back(entry.path());
+	sort(directories.begin(), directories.end(),
+			[](const filesystem::path &lhs, const filesystem::path &rhs) {
+				return lhs.string().size() > rhs.string().size();
+			});
+	for (const filesystem::path &directory : directories)
+		setTime(directory, baseTime);
+}
+
+void TreeGenerator::generateTiny(const filesystem::path &root) {
+	size_t numFiles = scaled(20000);
+	for (size_t f = 0; f < numFiles; f++) {
+		filesystem::path dir = root / ("d" + to_string(f / 1000));
+		if (f % 1000 == 0)
+			filesystem::create_directories(dir);
+		writeFile(dir / ("f" + to_string(f)), uniform(0, 4096));
+	}
+}
+
+void TreeGenerator::generateWide(const filesystem::path &root) {
+	size_t numFiles = scaled(10000);
+	for (size_t f = 0; f < numFiles; f++)
+		writeFile(root / ("f" + to_string(f)), uniform(0, 1024));
+}
+
+void TreeGenerator::generateDeep(const filesystem::path &root) {
+	size_t depth = min(scaled(100), (size_t) 1000);
+	filesystem::path dir = root;
+	for (size_t d = 0; d < depth; d++) {
+		writeFile(dir / "f", uniform(0, 64 * 1024));
+		dir /= "d";
+		filesystem::create_directory(dir);
+	}
+}
+
+void TreeGenerator::generateHuge(const filesystem::path &root) {
+	for (size_t f = 0; f < 2; f++)
+		writeFile(root / ("huge" + to_string(f)), scaled(256 * 1024 * 1024));
+}
+
+void TreeGenerator::generateMixed(const filesystem::path &root) {
+	size_t numFiles = scaled(1000);
+	for (size_t f = 0; f < numFiles; f++) {
+		filesystem::path dir = root / ("d" + to_string(f / 100))
+				/ ("e" + to_string(f % 7));
+		filesystem::create_directories(dir);
+
+		// 90% small, 9.5% medium, 0.5% large files
+		uint64_t bucket = uniform(0, 999);
+		uint64_t size;
+		if (bucket < 900)
+			size = uniform(0, 64 * 1024);
+		else if (bucket < 995)
+			size = uniform(64 * 1024, 4 * 1024 * 1024);
+		else
+			size = uniform(4 * 1024 * 1024, 64 * 1024 * 1024);
+		writeFile(dir / ("f" + to_string(f)), size);
+	}
+}
+
+void TreeGenerator::generateSymlinks(const filesystem::path &root) {
+	size_t numLinks = scaled(1000);
+	filesystem::create_directories(root / "targets");
+	for (size_t l = 0; l < numLinks; l++) {
+		filesystem::path dir = root / ("d" + to_string(l / 100));
+		if (l % 100 == 0)
+			filesystem::create_directories(dir);
+		string target;
+		if (l % 2 == 0) {
+			// Valid relative link
+			string name = "t" + to_string(l);
+			writeFile(root / "targets" / name, uniform(0, 1024));
+			target = "../targets/" + name;
+		} else {
+			// Dangling absolute link
+			target = "/nonexistent/fastsync/bench/" + to_string(l);
+		}
+		filesystem::path link = dir / ("l" + to_string(l));
+		symlink(target.c_str(), link.c_str());
+		setTime(link, baseTime);
+	}
+}
+
+void TreeGenerator::mutate(const filesystem::path &root) {
+	size_t numFiles = scaled(1000);
+	for (size_t f = 0; f < numFiles; f++) {
+		filesystem::path file = root / ("d" + to_string(f / 100))
+				/ ("e" + to_string(f % 7)) / ("f" + to_string(f));
+		uint64_t action = uniform(0, 99);
+		if (action < 5) {
+			// Changed contents and mtime
+			writeFile(file, uniform(0, 256 * 1024));
+			setTime(file, baseTime + 1000);
+		} else if (action < 6) {
+			filesystem::remove(file);
+		} else if (action < 8) {
+			filesystem::path added = file;
+			added += "new";
+			writeFile(added, uniform(0, 256 * 1024));
+		}
+	}
+}
+
+bool TreeGenerator::Generate(const string &scenario,
+		const filesystem::path &root) {
+	filesystem::remove_all(root);
+	filesystem::create_directories(root);
+
+	if (scenario == "tiny")
+		generateTiny(root);
+	else if (scenario == "wide")
+		generateWide(root);
+	else if (scenario == "deep")
+		generateDeep(root);
+	else if (scenario == "huge")
+		generateHuge(root);
+	else if (scenario == "mixed")
+		generateMixed(root);
+	else if (scenario == "symlinks")
+		generateSymlinks(root);
+	else if (scenario == "incremental") {
+		// Both trees start from the same random state
+		mt19937_64 state = random;
+		generateMixed(root / "base");
+		random = state;
+		generateMixed(root / "changed");
+		mutate(root / "changed");
+	} else
+		return false;
+
+	fixDirectoryTimes(root);
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef BENCH_TREEGENERATOR_H_
+#define BENCH_TREEGENERATOR_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Creates synthetic source trees for benchmarking. The same seed and scale
+ * always produce the same tree: same names, sizes, contents and mtimes.
+ */
+class TreeGenerator {
+	std::mt19937_64 random;
+	double scale;
+	/// Pseudo random block that file contents are cut from.
+	std::vector<char> pattern;
+	/// Mtime given to all generated entries.
+	int64_t baseTime;
+
+	size_t scaled(size_t count) const;
+	uint64_t uniform(uint64_t min, uint64_t max);
+
+	void writeFile(const std::filesystem::path &path, uint64_t size);
+	void setTime(const std::filesystem::path &path, int64_t time);
+	/// Gives all directories below root the generator's mtime, deepest first.
+	void fixDirectoryTimes(const std::filesystem::path &root);
+
+	void generateTiny(const std::filesystem::path &root);
+	void generateWide(const std::filesystem::path &root);
+	void generateDeep(const std::filesystem::path &root);
+	void generateHuge(const std::filesystem::path &root);
+	void generateMixed(const std::filesystem::path &root);
+	void generateSymlinks(const std::filesystem::path &root);
+	/// Changes, adds and removes some entries of a mixed tree.
+	void mutate(const std::filesystem::path &root);
+
+public:
+	/**
+	 * @param scale Multiplies file counts and sizes. At scale 1 the complete
+	 * suite needs about 1.5 GB. The tiny scenario has 20000 files at scale 1,
+	 * so use scale 100 to get two million files.
+	 */
+	TreeGenerator(uint64_t seed, double scale);
+
+	/// Names of all scenarios that Generate() knows.
+	static std::vector<std::string> Scenarios();
+
+	/**
+	 * Creates the source tree of a scenario in root. For the "incremental"
+	 * scenario, root/base is the state the destination is synced to before
+	 * measuring and root/changed is the source of the measured run.
+	 * @returns false if the scenario is unknown.
+	 */
+	bool Generate(const std::string &scenario, const std::filesystem::path &root);
+};
+
+#endif /* BENCH_TREEGENERATOR_H_ */
@@ -0,0 +1,418 @@
+#include "TreeGenerator.h"
+#include "CountingBackend.h"
+
+#include "CopyTree.h"
+#include "CheckpointJournal.h"
+#include "SimulatedBackend.h"
+#include "ThreadPlacement.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+extern size_t chunkSize;
+extern size_t readerThreads;
+extern size_t writerThreads;
+extern bool workStealing;
+extern SchedulingPolicy schedulingPolicy;
+extern bool printProgress;
+
+/**
+ * Process wide counters which are sampled before and after a run.
+ */
+struct Sample {
+	chrono::steady_clock::time_point Wall;
+	/// CPU time of the thread calling copyTree(), i.e. the scheduler.
+	double SchedulerCpu;
+	/// User and system CPU time of the whole process.
+	double ProcessCpu;
+	/// From /proc/self/io: read and write calls only, metadata operations
+	/// are counted by CountingBackend.
+	uint64_t ReadSyscalls;
+	uint64_t WriteSyscalls;
+	uint64_t ReadChars;
+	uint64_t WriteChars;
+	/// Pages allocated on another node than the one of the allocating
+	/// thread, summed over all nodes of the system.
+	uint64_t OtherNodePages;
+
+	static Sample Take() {
+		Sample result;
+		result.Wall = chrono::steady_clock::now();
+
+		struct timespec threadTime;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &threadTime);
+		result.SchedulerCpu = threadTime.tv_sec + threadTime.tv_nsec * 1e-9;
+
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		result.ProcessCpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+				+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+
+		result.ReadSyscalls = result.WriteSyscalls = result.ReadChars =
+				result.WriteChars = 0;
+		ifstream io("/proc/self/io");
+		string key;
+		uint64_t value;
+		while (io >> key >> value) {
+			if (key == "syscr:")
+				result.ReadSyscalls = value;
+			else if (key == "syscw:")
+				result.WriteSyscalls = value;
+			else if (key == "rchar:")
+				result.ReadChars = value;
+			else if (key == "wchar:")
+				result.WriteChars = value;
+		}
+
+		result.OtherNodePages = 0;
+		for (int node = 0;; node++) {
+			ifstream numastat(
+					"/sys/devices/system/node/node" + to_string(node)
+							+ "/numastat");
+			if (!numastat)
+				break;
+			while (numastat >> key >> value)
+				if (key == "other_node")
+					result.OtherNodePages += value;
+		}
+		return result;
+	}
+};
+
+/// Resets the peak resident set size of the process (Linux >= 4.0).
+static void resetPeakRss() {
+	ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5" << endl;
+}
+
+/// Peak resident set size in kB since the last reset.
+static uint64_t peakRss() {
+	ifstream status("/proc/self/status");
+	string line;
+	while (getline(status, line))
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return stoull(line.substr(6));
+	return 0;
+}
+
+static void dropCaches() {
+	sync();
+	ofstream dropCaches("/proc/sys/vm/drop_caches");
+	dropCaches << "3" << endl;
+}
+
+/// Quotes a string for the JSON output.
+static string jsonString(const string &value) {
+	string result = "\"";
+	for (char c : value) {
+		if (c == '"' || c == '\\') {
+			result += '\\';
+			result += c;
+		} else if ((unsigned char) c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			result += escaped;
+		} else
+			result += c;
+	}
+	return result + "\"";
+}
+
+/// JSON object with the number of operations of each kind between two counts.
+static string jsonCounts(const CountingBackend::Counts &before,
+		const CountingBackend::Counts &after) {
+	stringstream result;
+	result << "{";
+	for (size_t o = 0; o < CountingBackend::NUM_OPERATIONS; o++)
+		result << (o == 0 ? "\"" : ",\"")
+				<< CountingBackend::Name((CountingBackend::Operation) o)
+				<< "\":" << after[o] - before[o];
+	result << "}";
+	return result.str();
+}
+
+static vector<string> splitList(const string &list) {
+	vector<string> result;
+	stringstream stream(list);
+	string item;
+	while (getline(stream, item, ','))
+		if (!item.empty())
+			result.push_back(item);
+	return result;
+}
+
+static void printUsage() {
+	cerr << "Usage: ./fastsync_bench [OPTIONS]" << endl
+			<< "Options (lists are comma separated):" << endl
+			<< "  --work-dir=DIR       Where trees are generated (default fastsync_bench_data)"
+			<< endl
+			<< "  --scenarios=LIST     Any of tiny,wide,deep,huge,mixed,symlinks,incremental"
+			<< endl
+			<< "  --scale=F            Multiplies file counts and sizes (default 1)"
+			<< endl
+			<< "  --seed=N             Seed of the tree generator (default 1)"
+			<< endl
+			<< "  --readers=LIST       Reader thread counts (default 1)" << endl
+			<< "  --writers=LIST       Writer thread counts (default 1,8)"
+			<< endl
+			<< "  --chunk-mb=LIST      Chunk sizes in MB (default 64)" << endl
+			<< "  --schedulers=LIST    central and/or steal (default central)"
+			<< endl
+			<< "  --policies=LIST      path,lpt,small-first,balanced (default path)"
+			<< endl
+			<< "  --repeat=N           Runs per configuration (default 1)"
+			<< endl
+			<< "  --label=NAME         Label of this build in the output"
+			<< endl
+			<< "  --sim-source[=SPEC]  Simulate a parallel filesystem on the source side"
+			<< endl
+			<< "  --sim-dest[=SPEC]    Simulate a parallel filesystem on the destination side"
+			<< endl
+			<< "  --reader-affinity=P  Bind readers to node:LIST or cpu:LIST"
+			<< endl
+			<< "  --writer-affinity=P  Bind writers to node:LIST or cpu:LIST"
+			<< endl
+			<< "  --scheduler-affinity=P Bind the scheduler to node:LIST or cpu:LIST"
+			<< endl
+			<< "  --journal            Journal every run like fastsync does by default"
+			<< endl
+			<< "  --drop-caches        Drop the page cache before every run"
+			<< endl << "  --keep               Keep the generated data" << endl;
+}
+
+int main(int argc, char **argv) {
+	filesystem::path workDir = "fastsync_bench_data";
+	vector<string> scenarios = TreeGenerator::Scenarios();
+	double scale = 1;
+	uint64_t seed = 1;
+	vector<string> readers = { "1" };
+	vector<string> writers = { "1", "8" };
+	vector<string> chunkSizes = { "64" };
+	vector<string> schedulers = { "central" };
+	vector<string> policies = { "path" };
+	size_t repeat = 1;
+	string label;
+	bool drop = false;
+	bool keep = false;
+	bool journaled = false;
+	unique_ptr<IoBackend> simulatedSource, simulatedDest;
+	string simulation;
+	string placement;
+
+	for (int a = 1; a < argc; a++) {
+		string arg = argv[a];
+		size_t equals = arg.find('=');
+		string key = arg.substr(0, equals);
+		string value = equals == string::npos ? "" : arg.substr(equals + 1);
+		if (key == "--work-dir")
+			workDir = value;
+		else if (key == "--scenarios")
+			scenarios = splitList(value);
+		else if (key == "--scale")
+			scale = atof(value.c_str());
+		else if (key == "--seed")
+			seed = stoull(value);
+		else if (key == "--readers")
+			readers = splitList(value);
+		else if (key == "--writers")
+			writers = splitList(value);
+		else if (key == "--chunk-mb")
+			chunkSizes = splitList(value);
+		else if (key == "--schedulers") {
+			schedulers = splitList(value);
+			for (const string &scheduler : schedulers)
+				if (scheduler != "central" && scheduler != "steal") {
+					printUsage();
+					return -1;
+				}
+		}
+		else if (key == "--policies") {
+			policies = splitList(value);
+			for (const string &policy : policies)
+				if (!parseSchedulingPolicy(policy, schedulingPolicy)) {
+					printUsage();
+					return -1;
+				}
+		} else if (key == "--repeat")
+			repeat = atoi(value.c_str());
+		else if (key == "--label")
+			label = value;
+		else if (key == "--sim-source" || key == "--sim-dest") {
+			SimulatedBackend::Config simConfig;
+			if (!simConfig.Parse(value)) {
+				printUsage();
+				return -1;
+			}
+			if (key == "--sim-source") {
+				simulatedSource.reset(new SimulatedBackend(sourceBackend, simConfig));
+				sourceBackend = simulatedSource.get();
+			} else {
+				simulatedDest.reset(new SimulatedBackend(destBackend, simConfig));
+				destBackend = simulatedDest.get();
+			}
+			simulation += (simulation.empty() ? "" : " ") + arg.substr(2);
+		} else if (key == "--reader-affinity" || key == "--writer-affinity"
+				|| key == "--scheduler-affinity") {
+			ThreadPlacement &target =
+					key == "--reader-affinity" ? readerPlacement :
+					key == "--writer-affinity" ?
+							writerPlacement : schedulerPlacement;
+			if (!target.Parse(value)) {
+				printUsage();
+				return -1;
+			}
+			placement += (placement.empty() ? "" : " ") + arg.substr(2);
+		} else if (key == "--journal")
+			journaled = true;
+		else if (key == "--drop-caches")
+			drop = true;
+		else if (key == "--keep")
+			keep = true;
+		else {
+			printUsage();
+			return -1;
+		}
+	}
+
+	// Count what fastsync asks of each side (on top of a simulation)
+	CountingBackend countingSource(sourceBackend), countingDest(destBackend);
+	sourceBackend = &countingSource;
+	destBackend = &countingDest;
+
+	printProgress = false;
+	raiseDescriptorLimit();
+	filesystem::create_directories(workDir);
+
+	for (const string &scenario : scenarios) {
+		filesystem::path sourceDir = workDir / scenario;
+		filesystem::path destDir = workDir / (scenario + ".out");
+
+		cerr << "Generating " << scenario << endl;
+		TreeGenerator generator(seed, scale);
+		if (!generator.Generate(scenario, sourceDir)) {
+			cerr << "Unknown scenario " << scenario << endl;
+			return -1;
+		}
+		bool incremental = scenario == "incremental";
+
+		for (const string &scheduler : schedulers)
+			for (const string &policy : policies)
+				for (const string &r : readers)
+					for (const string &w : writers)
+						for (const string &c : chunkSizes)
+							for (size_t run = 0; run < repeat; run++) {
+								workStealing = scheduler == "steal";
+								parseSchedulingPolicy(policy, schedulingPolicy);
+								readerThreads = stoul(r);
+								writerThreads = stoul(w);
+								chunkSize = stoull(c) * 1024 * 1024;
+
+								filesystem::remove_all(destDir);
+								if (incremental)
+									copyTree(sourceDir / "base", destDir);
+								if (drop)
+									dropCaches();
+
+								cerr << "Running " << scenario << " " << scheduler
+										<< " " << policy << " " << r << "R " << w << "W " << c
+										<< "MB" << endl;
+								// Started from scratch, as without --resume
+								CheckpointJournal runJournal;
+								if (journaled) {
+									if (!runJournal.Open(
+											destDir.string() + ".fastsync-journal",
+											false)) {
+										cerr << "Could not open journal" << endl;
+										return -1;
+									}
+									journal = &runJournal;
+								}
+								resetPeakRss();
+								CountingBackend::Counts sourceBefore =
+										countingSource.Get();
+								CountingBackend::Counts destBefore =
+										countingDest.Get();
+								Sample before = Sample::Take();
+								Summary summary = copyTree(
+										incremental ?
+												sourceDir / "changed" : sourceDir,
+										destDir);
+								Sample after = Sample::Take();
+								journal = nullptr;
+
+								double seconds = chrono::duration<double>(
+										after.Wall - before.Wall).count();
+								uint64_t jobs = summary.Counters[Summary::JOBS];
+								uint64_t bytes = summary.Counters[Summary::BYTES];
+								cout << "{\"label\":" << jsonString(label)
+										<< ",\"scenario\":" << jsonString(scenario)
+										<< ",\"scale\":" << scale
+										<< ",\"seed\":" << seed
+										<< ",\"simulation\":"
+										<< jsonString(simulation)
+										<< ",\"placement\":"
+										<< jsonString(placement)
+										<< ",\"scheduler\":" << jsonString(scheduler)
+										<< ",\"policy\":" << jsonString(policy)
+										<< ",\"journal\":"
+										<< (journaled ? "true" : "false")
+										<< ",\"readers\":" << readerThreads
+										<< ",\"writers\":" << writerThreads
+										<< ",\"chunk_mb\":" << c << ",\"run\":"
+										<< run << ",\"seconds\":" << seconds
+										<< ",\"jobs\":" << jobs << ",\"bytes\":"
+										<< bytes << ",\"errors\":"
+										<< summary.Errors() << ",\"files_per_s\":"
+										<< jobs / seconds << ",\"mb_per_s\":"
+										<< bytes / seconds / 1024 / 1024
+										<< ",\"cross_node_bytes\":"
+										<< summary.Counters[Summary::CROSS_NODE_BYTES]
+										<< ",\"numa_other_node_pages\":"
+										<< after.OtherNodePages
+												- before.OtherNodePages
+										<< ",\"read_syscalls\":"
+										<< after.ReadSyscalls - before.ReadSyscalls
+										<< ",\"write_syscalls\":"
+										<< after.WriteSyscalls
+												- before.WriteSyscalls
+										<< ",\"read_chars\":"
+										<< after.ReadChars - before.ReadChars
+										<< ",\"write_chars\":"
+										<< after.WriteChars - before.WriteChars
+										<< ",\"source_calls\":"
+										<< jsonCounts(sourceBefore,
+												countingSource.Get())
+										<< ",\"dest_calls\":"
+										<< jsonCounts(destBefore,
+												countingDest.Get())
+										<< ",\"peak_rss_kb\":" << peakRss()
+										<< ",\"scheduler_cpu_s\":"
+										<< after.SchedulerCpu - before.SchedulerCpu
+										<< ",\"process_cpu_s\":"
+										<< after.ProcessCpu - before.ProcessCpu
+										<< "}" << endl;
+							}
+
+		filesystem::remove_all(destDir);
+		filesystem::remove(destDir.string() + ".fastsync-journal");
+		if (!keep)
+			filesystem::remove_all(sourceDir);
+	}
+
+	// Only removed if nothing else is in there
+	std::error_code ec;
+	if (!keep)
+		filesystem::remove(workDir, ec);
+}
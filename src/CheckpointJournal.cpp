@@ -0,0 +1,131 @@
+#include "CheckpointJournal.h"
+
+#include "Job.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+extern size_t chunkSize;
+
+CheckpointJournal *journal = nullptr;
+
+CheckpointJournal::CheckpointJournal() :
+		fd(-1), batchRecords(0), lastSync(chrono::steady_clock::now()) {
+}
+
+CheckpointJournal::~CheckpointJournal() {
+	Sync();
+	if (fd >= 0)
+		close(fd);
+}
+
+bool CheckpointJournal::Open(const filesystem::path &path, bool resume) {
+	if (resume)
+		load(path);
+	fd = open(path.c_str(),
+			O_WRONLY | O_CREAT | O_APPEND | (resume ? 0 : O_TRUNC), 0644);
+	return fd >= 0;
+}
+
+void CheckpointJournal::load(const filesystem::path &path) {
+	ifstream in(path);
+	// Record: C <source size> <mtime sec> <mtime nsec> <chunk size> <chunk index> <path length> <path>
+	string type;
+	while (in >> type) {
+		FileEntry record;
+		size_t chunkIdx, pathLength;
+		if (type != "C"
+				|| !(in >> record.SourceSize >> record.SourceMtime.tv_sec
+						>> record.SourceMtime.tv_nsec >> record.ChunkSize
+						>> chunkIdx >> pathLength) || in.get() != ' ')
+			break;
+		string destPath(pathLength, '\0');
+		// The last record may be cut off if the process was killed
+		if (!in.read(&destPath[0], pathLength) || in.get() != '\n')
+			break;
+
+		FileEntry &entry = previous[destPath];
+		if (entry.SourceSize != record.SourceSize
+				|| entry.SourceMtime.tv_sec != record.SourceMtime.tv_sec
+				|| entry.SourceMtime.tv_nsec != record.SourceMtime.tv_nsec
+				|| entry.ChunkSize != record.ChunkSize) {
+			// Source changed between runs: older records are useless
+			entry = record;
+		}
+		if (entry.ChunksDone.size() <= chunkIdx)
+			entry.ChunksDone.resize(chunkIdx + 1, false);
+		entry.ChunksDone[chunkIdx] = true;
+	}
+}
+
+void CheckpointJournal::ChunkDone(const Job &job, size_t chunkIdx) {
+	string destPath = job.DestPath.string();
+	stringstream record;
+	record << "C " << job.SourceStat.st_size << " "
+			<< job.SourceStat.st_mtim.tv_sec << " "
+			<< job.SourceStat.st_mtim.tv_nsec << " " << chunkSize << " "
+			<< chunkIdx << " " << destPath.size() << " " << destPath << "\n";
+
+	string full;
+	{
+		lock_guard<mutex> lock(batchModified);
+		batch += record.str();
+		batchRecords++;
+		if (batchRecords >= BatchRecords
+				|| chrono::steady_clock::now() - lastSync
+						>= chrono::seconds(BatchSeconds))
+			full = takeBatch();
+	}
+	// The other writers keep recording while this one syncs
+	flush(full);
+}
+
+size_t CheckpointJournal::CompletedChunks(const Job &job,
+		size_t chunkSize) const {
+	auto entry = previous.find(job.DestPath.string());
+	if (entry == previous.end()
+			|| entry->second.SourceSize != job.SourceStat.st_size
+			|| entry->second.SourceMtime.tv_sec
+					!= job.SourceStat.st_mtim.tv_sec
+			|| entry->second.SourceMtime.tv_nsec
+					!= job.SourceStat.st_mtim.tv_nsec
+			|| entry->second.ChunkSize != chunkSize)
+		return 0;
+
+	size_t result = 0;
+	while (result < entry->second.ChunksDone.size()
+			&& entry->second.ChunksDone[result])
+		result++;
+	return result;
+}
+
+void CheckpointJournal::Sync() {
+	string records;
+	{
+		lock_guard<mutex> lock(batchModified);
+		records = takeBatch();
+	}
+	flush(records);
+}
+
+string CheckpointJournal::takeBatch() {
+	string records;
+	records.swap(batch);
+	batchRecords = 0;
+	lastSync = chrono::steady_clock::now();
+	return records;
+}
+
+void CheckpointJournal::flush(const string &records) {
+	if (fd >= 0 && !records.empty()) {
+		// One write per batch keeps records of concurrent processes apart
+		if (write(fd, records.data(), records.size())
+				== (ssize_t) records.size())
+			fdatasync(fd);
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef SRC_CHECKPOINTJOURNAL_H_
+#define SRC_CHECKPOINTJOURNAL_H_
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Job;
+
+/**
+ * Append-only record of the chunks that have been written, so that an
+ * interrupted sync can continue large files where it stopped.
+ * Every record names the destination file, the size and mtime of its source,
+ * the chunk size and the index of a written chunk. Records are collected and
+ * written plus synced in batches. A record only matches a job if source size,
+ * source mtime and chunk size are still the same.
+ */
+class CheckpointJournal {
+	struct FileEntry {
+		off_t SourceSize;
+		struct timespec SourceMtime;
+		size_t ChunkSize;
+		std::vector<bool> ChunksDone;
+
+		FileEntry() :
+				SourceSize(-1), SourceMtime { 0, 0 }, ChunkSize(0) {
+		}
+	};
+
+	int fd;
+	/// Chunks written by previous runs, by destination path.
+	std::unordered_map<std::string, FileEntry> previous;
+
+	/// Records which are not written to the file yet.
+	std::string batch;
+	size_t batchRecords;
+	std::chrono::steady_clock::time_point lastSync;
+	std::mutex batchModified;
+
+	void load(const std::filesystem::path &path);
+	/// Removes and returns the batch. Must be called with batchModified locked.
+	std::string takeBatch();
+	/// Writes and syncs records taken from the batch, without holding the lock.
+	void flush(const std::string &records);
+
+public:
+	/// Number of records after which a batch is written.
+	static constexpr size_t BatchRecords = 64;
+	/// Maximum age of a batch in seconds.
+	static constexpr int BatchSeconds = 1;
+
+	CheckpointJournal();
+	/// Writes the last batch.
+	~CheckpointJournal();
+
+	/**
+	 * Opens the journal file.
+	 * @param resume If true, the records of previous runs are loaded and new
+	 * records are appended. Otherwise the file is started from scratch.
+	 * @returns false if the file cannot be opened.
+	 */
+	bool Open(const std::filesystem::path &path, bool resume);
+
+	/**
+	 * Records that a chunk of the job was written to the destination.
+	 * Can be called from any thread.
+	 */
+	void ChunkDone(const Job &job, size_t chunkIdx);
+
+	/**
+	 * Number of chunks from the beginning of the job's file which previous
+	 * runs have written completely.
+	 */
+	size_t CompletedChunks(const Job &job, size_t chunkSize) const;
+
+	/// Writes and syncs all pending records.
+	void Sync();
+};
+
+/// Journal used by the writers, nullptr if no journal is kept.
+extern CheckpointJournal *journal;
+
+#endif /* SRC_CHECKPOINTJOURNAL_H_ */
@@ -0,0 +1,110 @@
+#include "ChunkHash.h"
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+#include <cstring>
+
+#ifdef HAVE_XXHASH
+
+const char *chunkHashName = "xxh3";
+
+uint64_t hashChunk(const void *data, size_t length) {
+	return XXH3_64bits(data, length);
+}
+
+#else
+
+const char *chunkHashName = "xxh64";
+
+// XXH64 as specified in https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+static const uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t Prime3 = 0x165667B19E3779F9ull;
+static const uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/// Little endian loads (fastsync only runs on little endian Linux).
+static inline uint64_t read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t accumulate(uint64_t acc, uint64_t input) {
+	acc += input * Prime2;
+	acc = rotl(acc, 31);
+	return acc * Prime1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+	acc ^= accumulate(0, val);
+	return acc * Prime1 + Prime4;
+}
+
+uint64_t hashChunk(const void *data, size_t length) {
+	const unsigned char *p = (const unsigned char*) data;
+	const unsigned char *end = p + length;
+	const uint64_t seed = 0;
+	uint64_t h;
+
+	if (length >= 32) {
+		uint64_t v1 = seed + Prime1 + Prime2;
+		uint64_t v2 = seed + Prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - Prime1;
+		const unsigned char *limit = end - 32;
+		do {
+			v1 = accumulate(v1, read64(p));
+			v2 = accumulate(v2, read64(p + 8));
+			v3 = accumulate(v3, read64(p + 16));
+			v4 = accumulate(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = mergeRound(h, v1);
+		h = mergeRound(h, v2);
+		h = mergeRound(h, v3);
+		h = mergeRound(h, v4);
+	} else
+		h = seed + Prime5;
+
+	h += length;
+
+	while (p + 8 <= end) {
+		h ^= accumulate(0, read64(p));
+		h = rotl(h, 27) * Prime1 + Prime4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t) read32(p) * Prime1;
+		h = rotl(h, 23) * Prime2 + Prime3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (*p) * Prime5;
+		h = rotl(h, 11) * Prime1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= Prime2;
+	h ^= h >> 29;
+	h *= Prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+#endif
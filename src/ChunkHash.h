@@ -0,0 +1,16 @@
+#ifndef SRC_CHUNKHASH_H_
+#define SRC_CHUNKHASH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/// Name of the hash used for chunks: "xxh3" with libxxhash, "xxh64" without.
+extern const char *chunkHashName;
+
+/**
+ * Non-cryptographic 64 bit hash of a chunk. XXH3 (vectorized) if fastsync is
+ * built with libxxhash, otherwise a portable XXH64.
+ */
+uint64_t hashChunk(const void *data, size_t length);
+
+#endif /* SRC_CHUNKHASH_H_ */
@@ -0,0 +1,633 @@
+#include "Coordinator.h"
+
+#include "CopyTree.h"
+#include "IoBackend.h"
+#include "ThrottledBackend.h"
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+extern size_t chunkSize;
+extern size_t readerThreads;
+extern size_t writerThreads;
+extern bool workStealing;
+extern SchedulingPolicy schedulingPolicy;
+extern VerifyMode verifyMode;
+
+// == Protocol ==
+// Every message is a list of fields. It is sent as "<#fields>\n" followed by
+// "<length>\n<bytes>" for every field. The first field is the message type:
+// coordinator -> worker: CONFIG <chunkSize> <#readers> <#writers> <workStealing> <policy> <verifyMode> <bucketEntries>
+//                               <readLimit> <writeLimit> <metadataLimit> <#workers>
+//                        PART <source> <dest> [<source> <dest> ...]
+//                        EXIT
+// worker -> coordinator: READY
+//                        RESULT <summary counters...>
+// The throttle limits are given in thousandths of bytes/s and operations/s and
+// are shared evenly by #workers. CONFIG is sent again whenever #workers changes.
+
+static bool writeAll(int fd, const char *data, size_t size) {
+	while (size > 0) {
+		// A closed connection fails with EPIPE instead of killing the process
+		ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+		if (written <= 0)
+			return false;
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+static bool readAll(int fd, char *data, size_t size) {
+	while (size > 0) {
+		ssize_t numRead = read(fd, data, size);
+		if (numRead <= 0)
+			return false;
+		data += numRead;
+		size -= numRead;
+	}
+	return true;
+}
+
+/// Longest decimal number that always fits into 64 bits.
+static const size_t maxDigits = 19;
+
+/// Parses a field received from the other side. Returns false if it is not a number.
+static bool parseNumber(const string &digits, uint64_t &number) {
+	if (digits.empty() || digits.size() > maxDigits
+			|| digits.find_first_not_of("0123456789") != string::npos)
+		return false;
+	number = stoull(digits);
+	return true;
+}
+
+static bool readNumber(int fd, size_t &number) {
+	string digits;
+	char c;
+	while (true) {
+		if (!readAll(fd, &c, 1))
+			return false;
+		if (c == '\n')
+			break;
+		if (digits.size() == maxDigits)
+			return false;
+		digits += c;
+	}
+	uint64_t value;
+	if (!parseNumber(digits, value))
+		return false;
+	number = value;
+	return true;
+}
+
+static bool sendMessage(int fd, const vector<string> &fields) {
+	string message = to_string(fields.size()) + "\n";
+	for (const string &field : fields)
+		message += to_string(field.size()) + "\n" + field;
+	return writeAll(fd, message.data(), message.size());
+}
+
+/**
+ * Receives a message of at most maxFields fields. Fields are paths or numbers,
+ * so anything longer than PATH_MAX is rejected as well.
+ */
+static bool receiveMessage(int fd, vector<string> &fields, size_t maxFields) {
+	size_t numFields;
+	if (!readNumber(fd, numFields) || numFields == 0 || numFields > maxFields)
+		return false;
+	fields.resize(numFields);
+	for (string &field : fields) {
+		size_t size;
+		if (!readNumber(fd, size) || size > PATH_MAX)
+			return false;
+		field.resize(size);
+		if (size > 0 && !readAll(fd, &field[0], size))
+			return false;
+	}
+	return true;
+}
+
+static bool splitEndpoint(const string &endpoint, string &host,
+		string &port) {
+	size_t colon = endpoint.rfind(':');
+	if (colon == string::npos)
+		return false;
+	host = endpoint.substr(0, colon);
+	port = endpoint.substr(colon + 1);
+	return !port.empty();
+}
+
+/**
+ * Opens a TCP socket to or on HOST:PORT. An empty host listens on all interfaces.
+ */
+static int openSocket(const string &endpoint, bool listening) {
+	string host, port;
+	if (!splitEndpoint(endpoint, host, port))
+		return -1;
+
+	struct addrinfo hints = { };
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	struct addrinfo *addresses;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+			&hints, &addresses) != 0)
+		return -1;
+
+	int fd = -1;
+	for (struct addrinfo *a = addresses; a != nullptr; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (listening) {
+			int reuse = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+			if (bind(fd, a->ai_addr, a->ai_addrlen) == 0
+					&& listen(fd, 64) == 0)
+				break;
+		} else if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(addresses);
+	return fd;
+}
+
+// == Worker ==
+
+/// Number of fields of a CONFIG message.
+static const size_t configFields = 12;
+
+static int runWorkerOnSocket(int fd) {
+	if (!sendMessage(fd, { "READY" }))
+		return -1;
+
+	// Partitions are at most as big as the buckets announced by CONFIG
+	size_t maxFields = configFields;
+	vector<string> message;
+	while (receiveMessage(fd, message, maxFields)) {
+		if (message[0] == "EXIT")
+			return 0;
+		if (message[0] == "CONFIG" && message.size() == configFields) {
+			uint64_t newChunkSize, readers, writers, verify, bucketEntries,
+					readLimit, writeLimit, metadataLimit, sharedBy;
+			if (!parseNumber(message[1], newChunkSize)
+					|| !parseNumber(message[2], readers)
+					|| !parseNumber(message[3], writers)
+					|| !parseNumber(message[6], verify)
+					|| verify > (uint64_t) VerifyMode::DIRECT
+					|| !parseNumber(message[7], bucketEntries)
+					|| bucketEntries > numeric_limits<size_t>::max() / 2
+					|| !parseNumber(message[8], readLimit)
+					|| !parseNumber(message[9], writeLimit)
+					|| !parseNumber(message[10], metadataLimit)
+					|| !parseNumber(message[11], sharedBy) || sharedBy == 0)
+				return -1;
+			// A throttling coordinator splits its limits over its workers
+			if (readLimit != 0 || writeLimit != 0 || metadataLimit != 0) {
+				ThrottledBackend::Limits limits;
+				limits.ReadBandwidth = readLimit / 1000.0;
+				limits.WriteBandwidth = writeLimit / 1000.0;
+				limits.MetadataOps = metadataLimit / 1000.0;
+				ThrottledBackend::SetLimits(limits);
+				ThrottledBackend::SetShare(1.0 / sharedBy);
+			}
+			maxFields = max(configFields, 1 + 2 * max(bucketEntries,
+					(uint64_t) 1));
+			chunkSize = newChunkSize;
+			readerThreads = readers;
+			writerThreads = writers;
+			workStealing = message[4] == "1";
+			parseSchedulingPolicy(message[5], schedulingPolicy);
+			verifyMode = (VerifyMode) verify;
+		} else if (message[0] == "PART") {
+			// All entries of a partition share one pipeline
+			vector<pair<filesystem::path, filesystem::path>> entries;
+			for (size_t f = 1; f + 1 < message.size(); f += 2)
+				entries.emplace_back(message[f], message[f + 1]);
+			Summary summary = copyTree(entries);
+
+			vector<string> result = { "RESULT" };
+			for (uint64_t counter : summary.Serialize())
+				result.push_back(to_string(counter));
+			if (!sendMessage(fd, result))
+				return -1;
+		}
+	}
+	return -1;
+}
+
+int runWorker(const string &endpoint) {
+	int fd = openSocket(endpoint, false);
+	if (fd < 0) {
+		cerr << "Could not connect to coordinator " << endpoint << endl;
+		return -1;
+	}
+	int result = runWorkerOnSocket(fd);
+	close(fd);
+	return result;
+}
+
+// == Coordinator ==
+
+namespace {
+
+/**
+ * Entries which are copied by one worker with a single copyTree() call.
+ */
+struct Partition {
+	vector<pair<filesystem::path, filesystem::path>> Entries;
+	/// Estimated amount of work, used to hand out big partitions first.
+	uint64_t Weight;
+
+	Partition() :
+			Weight(0) {
+	}
+};
+
+struct WorkerConnection {
+	int Fd;
+	/// Process id for local workers, -1 for remote workers.
+	pid_t Pid;
+	/// Partitions this worker will process next unless stolen.
+	deque<size_t> Queue;
+	/// Partition in progress or -1 if the worker is idle.
+	size_t Current;
+	bool Ready;
+
+	WorkerConnection(int fd, pid_t pid) :
+			Fd(fd), Pid(pid), Current(-1), Ready(false) {
+	}
+};
+
+/**
+ * Walks the source tree down to the split depth. Directories above the split
+ * depth are remembered in preorder, everything else ends up in a partition.
+ */
+void collectPartitions(const filesystem::path &pathIn,
+		const filesystem::path &pathOut, size_t depth,
+		const CoordinatorConfig &config,
+		vector<pair<filesystem::path, filesystem::path>> &intermediates,
+		vector<Partition> &partitions) {
+	intermediates.emplace_back(pathIn, pathOut);
+
+	Partition bucket;
+	vector<string> names;
+	shared_ptr<DirHandle> dirIn = sourceBackend->OpenDirectory(nullptr,
+			pathIn.string());
+	sourceBackend->ListDirectory(*dirIn, names);
+	for (const string &name : names) {
+		filesystem::path subIn = pathIn / name;
+		filesystem::path subOut = pathOut / name;
+
+		struct stat subStat = { };
+		if (sourceBackend->Stat(dirIn.get(), name, &subStat,
+				STATX_TYPE | STATX_SIZE) == 0
+				&& S_ISDIR(subStat.st_mode)) {
+			if (depth + 1 < config.SplitDepth) {
+				collectPartitions(subIn, subOut, depth + 1, config,
+						intermediates, partitions);
+			} else {
+				// Size of a subtree is unknown: treat it as heavier than any file
+				Partition subtree;
+				subtree.Entries.emplace_back(subIn, subOut);
+				subtree.Weight = numeric_limits<uint64_t>::max();
+				partitions.push_back(subtree);
+			}
+		} else if (S_ISREG(subStat.st_mode)
+				&& (uint64_t) subStat.st_size >= config.BucketBytes) {
+			Partition bigFile;
+			bigFile.Entries.emplace_back(subIn, subOut);
+			bigFile.Weight = subStat.st_size;
+			partitions.push_back(bigFile);
+		} else {
+			// Small entries (and the ones that failed to stat) share a bucket
+			bucket.Entries.emplace_back(subIn, subOut);
+			bucket.Weight += subStat.st_size;
+			if (bucket.Entries.size() >= config.BucketEntries) {
+				partitions.push_back(bucket);
+				bucket = Partition();
+			}
+		}
+	}
+	if (!bucket.Entries.empty())
+		partitions.push_back(bucket);
+}
+
+/**
+ * Returns the next partition for a worker: the front of its own queue or,
+ * if that is empty, the back of the longest queue of any other worker.
+ * @returns -1 if there is nothing left.
+ */
+size_t nextPartition(vector<WorkerConnection> &workers, size_t w,
+		deque<size_t> &unowned) {
+	if (!workers[w].Queue.empty()) {
+		size_t result = workers[w].Queue.front();
+		workers[w].Queue.pop_front();
+		return result;
+	}
+
+	deque<size_t> *victim = &unowned;
+	for (WorkerConnection &worker : workers)
+		if (worker.Queue.size() > victim->size())
+			victim = &worker.Queue;
+	if (victim->empty())
+		return -1;
+
+	size_t result = victim->back();
+	victim->pop_back();
+	return result;
+}
+
+/**
+ * Creates a directory above the partitions such that the workers can copy
+ * into it. Unlike copyTree(), it does not set any attributes: a read-only
+ * source mode would lock the workers out. The final pass sets them.
+ */
+void createIntermediate(const filesystem::path &pathIn,
+		const filesystem::path &pathOut) {
+	struct stat sourceStat, destStat;
+	if (sourceBackend->Stat(nullptr, pathIn.string(), &sourceStat,
+			STATX_TYPE | STATX_MODE) != 0)
+		return;
+	bool exists = destBackend->Stat(nullptr, pathOut.string(), &destStat,
+			STATX_TYPE | STATX_MODE) == 0;
+	// Anything else in the way is replaced, like copyTree() does
+	if (exists && !S_ISDIR(destStat.st_mode)) {
+		if (!destBackend->RemoveAll(nullptr, pathOut.string()))
+			return;
+		exists = false;
+	}
+	// The owner needs full access until the final pass sets the mode. Errors
+	// are reported by the final pass.
+	if (!exists)
+		destBackend->Mkdir(nullptr, pathOut.string(),
+				(sourceStat.st_mode & 07777) | S_IRWXU);
+	else if ((destStat.st_mode & S_IRWXU) != S_IRWXU)
+		destBackend->Chmod(nullptr, pathOut.string(),
+				(destStat.st_mode & 07777) | S_IRWXU);
+}
+
+/// CONFIG for a worker which shares the throttle limits with sharedBy - 1 others.
+vector<string> configMessage(const CoordinatorConfig &config,
+		size_t sharedBy) {
+	ThrottledBackend::Limits limits = ThrottledBackend::GetLimits();
+	return { "CONFIG", to_string(chunkSize), to_string(readerThreads),
+			to_string(writerThreads), workStealing ? "1" : "0",
+			schedulingPolicyName(schedulingPolicy), to_string((int) verifyMode),
+			to_string(config.BucketEntries), to_string(
+					llround(limits.ReadBandwidth * 1000)), to_string(
+					llround(limits.WriteBandwidth * 1000)), to_string(
+					llround(limits.MetadataOps * 1000)), to_string(sharedBy) };
+}
+
+/// Number of workers which are still connected.
+size_t connectedWorkers(const vector<WorkerConnection> &workers) {
+	return count_if(workers.begin(), workers.end(),
+			[](const WorkerConnection &worker) {
+				return worker.Fd >= 0;
+			});
+}
+
+/// Closes the connection of a lost worker and gives its work to the others.
+void loseWorker(WorkerConnection &worker, deque<size_t> &unowned) {
+	if (worker.Current != (size_t) -1)
+		unowned.push_front(worker.Current);
+	unowned.insert(unowned.end(), worker.Queue.begin(), worker.Queue.end());
+	worker.Queue.clear();
+	worker.Current = -1;
+	close(worker.Fd);
+	worker.Fd = -1;
+}
+
+bool sendPartition(WorkerConnection &worker, const Partition &partition) {
+	vector<string> message = { "PART" };
+	for (const auto &entry : partition.Entries) {
+		message.push_back(entry.first.string());
+		message.push_back(entry.second.string());
+	}
+	return sendMessage(worker.Fd, message);
+}
+
+}
+
+Summary runCoordinator(const filesystem::path &pathIn,
+		const filesystem::path &pathOut, const CoordinatorConfig &config) {
+	// Only directories can be split
+	struct stat rootStat;
+	if (sourceBackend->Stat(nullptr, pathIn.string(), &rootStat, STATX_TYPE)
+			!= 0 || !S_ISDIR(rootStat.st_mode) || config.SplitDepth == 0)
+		return copyTree(pathIn, pathOut);
+
+	// == Partitioning ==
+
+	vector<pair<filesystem::path, filesystem::path>> intermediates;
+	vector<Partition> partitions;
+	collectPartitions(pathIn, pathOut, 0, config, intermediates, partitions);
+	stable_sort(partitions.begin(), partitions.end(),
+			[](const Partition &lhs, const Partition &rhs) {
+				return lhs.Weight > rhs.Weight;
+			});
+
+	// Create the directories above the partitions such that the workers can
+	// copy into them
+	Summary summary;
+	for (const auto &intermediate : intermediates)
+		createIntermediate(intermediate.first, intermediate.second);
+
+	// == Workers ==
+
+	vector<WorkerConnection> workers;
+	deque<size_t> unowned;
+
+	if (!partitions.empty()) {
+		cout.flush();
+		for (size_t w = 0; w < config.LocalWorkers; w++) {
+			int fds[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+				break;
+			pid_t pid = fork();
+			if (pid == 0) {
+				close(fds[0]);
+				for (WorkerConnection &worker : workers)
+					close(worker.Fd);
+				_exit(runWorkerOnSocket(fds[1]) == 0 ? 0 : 1);
+			}
+			close(fds[1]);
+			if (pid < 0) {
+				close(fds[0]);
+				break;
+			}
+			workers.emplace_back(fds[0], pid);
+		}
+
+		// Deal the partitions to the local workers, biggest first, always to
+		// the worker with the least work so far. Remote workers start empty
+		// and steal.
+		vector<uint64_t> load(workers.size(), 0);
+		for (size_t p = 0; p < partitions.size(); p++) {
+			if (workers.empty()) {
+				unowned.push_back(p);
+				continue;
+			}
+			// Subtrees weigh the maximum: saturate and break ties by the
+			// number of partitions, so they are dealt round robin
+			size_t lightest = 0;
+			for (size_t w = 1; w < workers.size(); w++)
+				if (load[w] < load[lightest] || (load[w] == load[lightest]
+						&& workers[w].Queue.size()
+								< workers[lightest].Queue.size()))
+					lightest = w;
+			workers[lightest].Queue.push_back(p);
+			const uint64_t maxLoad = numeric_limits<uint64_t>::max();
+			load[lightest] =
+					partitions[p].Weight >= maxLoad - load[lightest] ?
+							maxLoad : load[lightest] + partitions[p].Weight;
+		}
+	}
+
+	int listenFd = -1;
+	if (!partitions.empty() && !config.Listen.empty()) {
+		listenFd = openSocket(config.Listen, true);
+		if (listenFd < 0)
+			cerr << "Could not listen on " << config.Listen << endl;
+	}
+
+	if (workers.empty() && listenFd < 0) {
+		// Nobody to hand out the work to: do it in this process
+		for (const Partition &partition : partitions)
+			summary += copyTree(partition.Entries);
+		partitions.clear();
+	}
+
+	size_t partitionsDone = 0;
+	size_t sharedBy = connectedWorkers(workers);
+	while (partitionsDone < partitions.size()) {
+		vector<pollfd> fds;
+		for (WorkerConnection &worker : workers)
+			fds.push_back( { worker.Fd, POLLIN, 0 });
+		if (listenFd >= 0)
+			fds.push_back( { listenFd, POLLIN, 0 });
+		if (fds.empty())
+			break;
+		if (poll(&fds[0], fds.size(), -1) < 0)
+			continue;
+
+		size_t polledWorkers = workers.size();
+		for (size_t w = 0; w < polledWorkers; w++) {
+			WorkerConnection &worker = workers[w];
+			if (worker.Fd < 0 || fds[w].revents == 0)
+				continue;
+
+			vector<string> message;
+			vector<uint64_t> counters;
+			bool valid = receiveMessage(worker.Fd, message,
+					1 + Summary().Serialize().size());
+			if (valid && message[0] == "RESULT") {
+				counters.resize(message.size() - 1);
+				for (size_t f = 1; valid && f < message.size(); f++)
+					valid = parseNumber(message[f], counters[f - 1]);
+				Summary result;
+				valid = valid && worker.Current != (size_t) -1
+						&& result.Deserialize(counters);
+				if (valid) {
+					summary += result;
+					partitionsDone++;
+					worker.Current = -1;
+				}
+			} else if (valid && message[0] == "READY") {
+				worker.Ready = true;
+				valid = sendMessage(worker.Fd,
+						configMessage(config, connectedWorkers(workers)));
+			}
+
+			if (!valid)
+				loseWorker(worker, unowned);
+		}
+
+		// Accept new remote workers
+		if (listenFd >= 0 && (fds.back().revents & POLLIN)) {
+			int fd = accept(listenFd, nullptr, nullptr);
+			if (fd >= 0)
+				workers.emplace_back(fd, -1);
+		}
+
+		// Workers joined or were lost: update the throttle shares. The
+		// workers apply them before their next partition.
+		if (connectedWorkers(workers) != sharedBy) {
+			sharedBy = connectedWorkers(workers);
+			for (WorkerConnection &worker : workers)
+				if (worker.Fd >= 0 && worker.Ready
+						&& !sendMessage(worker.Fd,
+								configMessage(config, sharedBy)))
+					loseWorker(worker, unowned);
+		}
+
+		// Hand out work to all idle workers
+		for (size_t w = 0; w < workers.size(); w++) {
+			WorkerConnection &worker = workers[w];
+			if (worker.Fd < 0 || !worker.Ready || worker.Current != (size_t) -1)
+				continue;
+			size_t p = nextPartition(workers, w, unowned);
+			if (p == (size_t) -1)
+				break;
+			worker.Current = p;
+			if (!sendPartition(worker, partitions[p])) {
+				// Its work may go to workers which were skipped as idle
+				loseWorker(worker, unowned);
+				w = -1;
+			}
+		}
+
+		// Drop closed connections of workers that are not running anymore
+		for (size_t w = workers.size(); w > 0; w--) {
+			if (workers[w - 1].Fd < 0) {
+				if (workers[w - 1].Pid > 0)
+					waitpid(workers[w - 1].Pid, nullptr, 0);
+				workers.erase(workers.begin() + w - 1);
+			}
+		}
+
+		if (workers.empty() && listenFd < 0 && partitionsDone < partitions.size()) {
+			cerr << "All workers lost, copying the rest locally" << endl;
+			for (size_t p : unowned)
+				summary += copyTree(partitions[p].Entries);
+			break;
+		}
+	}
+
+	if (listenFd >= 0)
+		close(listenFd);
+	for (WorkerConnection &worker : workers) {
+		sendMessage(worker.Fd, { "EXIT" });
+		close(worker.Fd);
+		if (worker.Pid > 0)
+			waitpid(worker.Pid, nullptr, 0);
+	}
+
+	// == Finalize directories bottom up ==
+
+	for (auto intermediate = intermediates.rbegin();
+			intermediate != intermediates.rend(); intermediate++)
+		summary += copyTree(intermediate->first, intermediate->second, false);
+
+	return summary;
+}
@@ -0,0 +1,49 @@
+#ifndef SRC_COORDINATOR_H_
+#define SRC_COORDINATOR_H_
+
+#include "Summary.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * Settings for distributing one sync over several fastsync processes.
+ */
+struct CoordinatorConfig {
+	/// Number of worker processes forked on this machine.
+	size_t LocalWorkers;
+	/// HOST:PORT to accept remote workers on. Empty if only local workers are used.
+	std::string Listen;
+	/// Directory levels below the source root which are split into partitions.
+	size_t SplitDepth;
+	/// Regular files of at least this size get a partition of their own.
+	uint64_t BucketBytes;
+	/// Maximum number of small entries that are bundled into one partition.
+	size_t BucketEntries;
+
+	CoordinatorConfig() :
+			LocalWorkers(0), SplitDepth(1), BucketBytes(1024 * 1024 * 1024), BucketEntries(
+					256) {
+	}
+};
+
+/**
+ * Partitions the source tree and lets worker processes copy the partitions.
+ * Every worker gets a queue of partitions up front. A worker whose queue
+ * runs empty steals the remaining partitions of the most loaded worker.
+ * Directories above the partitions are created before and finalized after
+ * the workers are done.
+ * @returns The sum of the summaries reported by all workers.
+ */
+Summary runCoordinator(const std::filesystem::path &pathIn,
+		const std::filesystem::path &pathOut, const CoordinatorConfig &config);
+
+/**
+ * Connects to a coordinator at HOST:PORT and copies partitions until the
+ * coordinator has no more work.
+ * @returns 0 on success, -1 if the connection could not be established.
+ */
+int runWorker(const std::string &endpoint);
+
+#endif /* SRC_COORDINATOR_H_ */
@@ -0,0 +1,472 @@
+#include "CopyTree.h"
+
+#include "ThreadsafeBuffer.h"
+#include "Task.h"
+#include "Job.h"
+#include "ModReader.h"
+#include "ModWriter.h"
+#include "ModVerifier.h"
+#include "ModStealer.h"
+#include "WorkDeque.h"
+#include "IoBackend.h"
+#include "CheckpointJournal.h"
+#include "ThreadPlacement.h"
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <vector>
+#include <set>
+
+using namespace std;
+
+size_t chunkSize = 64 * 1024 * 1024;
+size_t readerThreads = 1;
+size_t writerThreads = 8;
+bool workStealing = false;
+SchedulingPolicy schedulingPolicy = SchedulingPolicy::PATH;
+VerifyMode verifyMode = VerifyMode::OFF;
+bool printProgress = true;
+
+static const char *policyNames[] = { "path", "lpt", "small-first", "balanced" };
+
+bool parseSchedulingPolicy(const string &name, SchedulingPolicy &policy) {
+	for (size_t p = 0; p < sizeof(policyNames) / sizeof(policyNames[0]); p++)
+		if (name == policyNames[p]) {
+			policy = (SchedulingPolicy) p;
+			return true;
+		}
+	return false;
+}
+
+const char* schedulingPolicyName(SchedulingPolicy policy) {
+	return policyNames[(size_t) policy];
+}
+
+/**
+ * Copies with ModStealer threads that create the successor tasks themselves
+ * instead of a central scheduling loop. The reader and writer counts limit
+ * how many threads access the source and the destination at the same time.
+ */
+static Summary copyTreeStealing(
+		const vector<pair<filesystem::path, filesystem::path>> &entries,
+		bool recursive) {
+	StealingContext context(readerThreads, writerThreads, recursive);
+
+	vector<ModStealer*> stealers;
+	for (size_t s = 0; s < readerThreads + writerThreads; s++) {
+		context.Deques.push_back(new WorkDeque<Task>());
+		ModStealer *modStealer = new ModStealer();
+		modStealer->Context = &context;
+		modStealer->Index = s;
+		// The first threads are placed like readers, the others like writers
+		const ThreadPlacement &placement =
+				s < readerThreads ? readerPlacement : writerPlacement;
+		size_t thread = s < readerThreads ? s : s - readerThreads;
+		if (const cpu_set_t *cpus = placement.Cpus(thread))
+			modStealer->Pin(*cpus, placement.Node(thread));
+		stealers.push_back(modStealer);
+	}
+
+	context.PendingRoots = entries.size();
+	for (const auto &entry : entries) {
+		Job *rootJob = new Job();
+		rootJob->SourcePath = entry.first;
+		rootJob->DestPath = entry.second;
+		context.LiveJobs++;
+		context.Push(0, new Task(Task::TaskType::INIT, rootJob));
+	}
+
+	for (ModStealer *stealer : stealers)
+		stealer->Start();
+
+	{
+		unique_lock<mutex> lock(context.IdleMutex);
+		context.DoneSignal.wait(lock, [&context] {
+			return context.Done;
+		});
+	}
+
+	for (ModStealer *stealer : stealers)
+		stealer->Stop();
+	for (ModStealer *stealer : stealers)
+		delete stealer;
+	for (WorkDeque<Task> *deque : context.Deques)
+		delete deque;
+
+	if (journal != nullptr)
+		journal->Sync();
+
+	return context.Result;
+}
+
+Summary copyTree(const filesystem::path &pathIn,
+		const filesystem::path &pathOut, bool recursive) {
+	return copyTree( { { pathIn, pathOut } }, recursive);
+}
+
+Summary copyTree(
+		const vector<pair<filesystem::path, filesystem::path>> &entries,
+		bool recursive) {
+	if (entries.empty())
+		return Summary();
+	if (workStealing)
+		return copyTreeStealing(entries, recursive);
+
+	Summary summary;
+
+	// == Initialize Pipeline ==
+
+	// Buffers
+	const size_t queueSize = max(readerThreads, writerThreads) * 2;
+	ThreadsafeBuffer<Task> TasksOpen(queueSize);
+	ThreadsafeBuffer<Task> TasksWritten(queueSize);
+	ThreadsafeBuffer<Task> TasksVerify(queueSize);
+
+	// Read tasks are queued per NUMA node of the writers
+	map<int, ThreadsafeBuffer<Task>*> tasksRead;
+	for (size_t w = 0; w < writerThreads; w++)
+		if (tasksRead.find(writerPlacement.Node(w)) == tasksRead.end())
+			tasksRead[writerPlacement.Node(w)] = new ThreadsafeBuffer<Task>(
+					queueSize);
+
+	// Readers
+	vector<ModReader*> readers;
+	for (size_t r = 0; r < readerThreads; r++) {
+		ModReader *modReader = new ModReader();
+		modReader->In = &TasksOpen;
+		// Hand over to writers on the same node, or spread over all nodes
+		auto out = tasksRead.find(readerPlacement.Node(r));
+		if (out == tasksRead.end()) {
+			out = tasksRead.begin();
+			advance(out, r % tasksRead.size());
+		}
+		modReader->Out = out->second;
+		modReader->OutNode = out->first;
+		for (const auto &other : tasksRead)
+			if (other.second != modReader->Out)
+				modReader->Overflow.push_back(other.second);
+		if (const cpu_set_t *cpus = readerPlacement.Cpus(r))
+			modReader->Pin(*cpus, readerPlacement.Node(r));
+		modReader->Start();
+		readers.push_back(modReader);
+	}
+
+	// Writers
+	vector<ModWriter*> writers;
+	for (size_t w = 0; w < writerThreads; w++) {
+		ModWriter *modWriter = new ModWriter();
+		modWriter->In = tasksRead[writerPlacement.Node(w)];
+		modWriter->Out = &TasksWritten;
+		if (const cpu_set_t *cpus = writerPlacement.Cpus(w))
+			modWriter->Pin(*cpus, writerPlacement.Node(w));
+		modWriter->Start();
+		writers.push_back(modWriter);
+	}
+
+	// Verifiers read the destination like the writers
+	vector<ModVerifier*> verifiers;
+	for (size_t v = 0; verifyMode != VerifyMode::OFF && v < writerThreads;
+			v++) {
+		ModVerifier *modVerifier = new ModVerifier();
+		modVerifier->In = &TasksVerify;
+		modVerifier->Out = &TasksWritten;
+		if (const cpu_set_t *cpus = writerPlacement.Cpus(v))
+			modVerifier->Pin(*cpus, writerPlacement.Node(v));
+		modVerifier->Start();
+		verifiers.push_back(modVerifier);
+	}
+
+	// Bind the scheduling thread only now: threads inherit the affinity of
+	// the thread creating them
+	cpu_set_t previousCpus;
+	bool pinned = !schedulerPlacement.Empty()
+			&& pthread_getaffinity_np(pthread_self(), sizeof(previousCpus),
+					&previousCpus) == 0;
+	if (pinned)
+		schedulerPlacement.Apply(0);
+
+	// == Processing loop ==
+
+	struct JobPtrCompare {
+		SchedulingPolicy Policy;
+
+		bool operator() (const Job* lhs, const Job* rhs) const {
+			// Special case: If nullptrs are involved, they are always smaller
+			if(lhs == nullptr && rhs == nullptr)
+				return false;
+			if(lhs == nullptr)
+				return true;
+			if(rhs == nullptr)
+				return false;
+
+			// Size-aware policies: jobs of unknown size first such that sizes
+			// are known early, then by size
+			if (Policy != SchedulingPolicy::PATH
+					&& lhs->SchedulingSize != rhs->SchedulingSize) {
+				if (lhs->SchedulingSize == Job::UnknownSize)
+					return true;
+				if (rhs->SchedulingSize == Job::UnknownSize)
+					return false;
+				if (Policy == SchedulingPolicy::SMALL_FIRST)
+					return lhs->SchedulingSize < rhs->SchedulingSize;
+				return lhs->SchedulingSize > rhs->SchedulingSize;
+			}
+
+			// Both are not nullptr -> sequence id is most significant
+			if(lhs->SourcePath < rhs->SourcePath)
+				return true;
+			if(lhs->SourcePath >= rhs->SourcePath)
+				return false;
+
+			if(lhs < rhs)
+				return true;
+			return false;
+		}
+	};
+
+	// All jobs that are currently in flight
+	std::set<Job*, JobPtrCompare> jobsOpen(JobPtrCompare { schedulingPolicy });
+
+	// Insert the roots as first open jobs
+	for (const auto &entry : entries) {
+		Job *rootJob = new Job();
+		rootJob->SourcePath = entry.first;
+		rootJob->DestPath = entry.second;
+		jobsOpen.insert(rootJob);
+	}
+
+	// Pushes the next task of a job which can be executed, if any. The loop is
+	// the only producer of TasksOpen and TasksVerify and only pushes if there
+	// is room: blocking would stall the stages, which wait for the loop to
+	// take their finished tasks.
+	bool openFull = false, verifyFull = false;
+	auto scheduleTask = [&TasksOpen, &TasksVerify, &openFull, &verifyFull](
+			Job *job) {
+		// Check for init - can always be done
+		if (!openFull && job->InitState == Job::CopyState::OPEN) {
+			job->InitState = Job::CopyState::SCHEDULED;
+			TasksOpen.PushBack(new Task(Task::TaskType::INIT, job));
+			return true;
+		}
+
+		// Check for chunk - can be done if init is finished. Chunks are
+		// appended, so only after all previous chunks are written. Chunks
+		// which failed verification are rewritten in place at any time.
+		bool allChunksWritten = true;
+		if (job->InitState == Job::CopyState::DONE) {
+			bool prevChunksWritten = true;
+			for (size_t c = 0; c < job->ChunkState.size(); c++) {
+				if (!openFull && job->ChunkState[c] == Job::CopyState::OPEN
+						&& (prevChunksWritten || job->ChunkMismatches[c] > 0)) {
+					job->ChunkState[c] = Job::CopyState::SCHEDULED;
+					TasksOpen.PushBack(new Task(Task::TaskType::CHUNK, job, c));
+					return true;
+				}
+				// Verify written chunks while the next ones are copied
+				if (!verifyFull
+						&& job->ChunkState[c] == Job::CopyState::WRITTEN) {
+					job->ChunkState[c] = Job::CopyState::VERIFYING;
+					TasksVerify.PushBack(new Task(Task::TaskType::VERIFY, job, c));
+					return true;
+				}
+				if (job->ChunkState[c] != Job::CopyState::DONE)
+					allChunksWritten = false;
+				if (job->ChunkState[c] == Job::CopyState::OPEN
+						|| job->ChunkState[c] == Job::CopyState::SCHEDULED)
+					prevChunksWritten = false;
+			}
+		}
+
+		// Check for attributes - can be done if all chonks are written and there are no dependencies
+		if (!openFull && job->InitState == Job::CopyState::DONE
+				&& allChunksWritten
+				&& job->AttribState == Job::CopyState::OPEN
+				&& job->FinishDirDependencies.size() == 0) {
+			job->AttribState = Job::CopyState::SCHEDULED;
+			TasksOpen.PushBack(new Task(Task::TaskType::ATTRIBUTES, job));
+			return true;
+		}
+		return false;
+	};
+	bool reverse = false;
+	// Set if the last pass scheduled nothing: every open job then waits for a
+	// task in flight, so the loop blocks until the next one is finished
+	bool idle = false;
+
+	while (jobsOpen.size() > 0) {
+		// Try to create new jobs from finished tasks
+		if (idle || TasksWritten.Size() > 0) {
+			idle = false;
+			Task *task = TasksWritten.PopFront();
+			if (task->Type == Task::TaskType::INIT) {
+				if (printProgress)
+					cout << jobsOpen.size() << " I " << task->ItsJob->SourcePath
+							<< endl;
+
+				// If this was a directory task
+				if (recursive && S_ISDIR(task->ItsJob->SourceStat.st_mode)) {
+					// Start jobs for subdirectories and create dependencies
+					vector<string> names;
+					sourceBackend->ListDirectory(*task->ItsJob->SourceDir,
+							names);
+					for (const string &name : names) {
+						Job *subJob = createSubJob(task->ItsJob, name);
+						createDependency(task->ItsJob, subJob);
+						jobsOpen.insert(subJob);
+					}
+				}
+				task->ItsJob->InitState = Job::CopyState::DONE;
+
+				// The size is known now: move the job to its place
+				if (schedulingPolicy != SchedulingPolicy::PATH) {
+					jobsOpen.erase(task->ItsJob);
+					task->ItsJob->SchedulingSize =
+							S_ISREG(task->ItsJob->SourceStat.st_mode) ?
+									task->ItsJob->SourceStat.st_size : 0;
+					jobsOpen.insert(task->ItsJob);
+				}
+
+				// For links and files, check if copy has to continue at all. A
+				// file finished during init was written by this run and
+				// matches anyway.
+				if (!task->ItsJob->AttribApplied
+						&& (S_ISREG(task->ItsJob->DestStat.st_mode)
+								|| S_ISLNK(task->ItsJob->DestStat.st_mode))
+						&& task->ItsJob->DestStat.st_size
+								== task->ItsJob->SourceStat.st_size
+						&& task->ItsJob->DestStat.st_mtim.tv_sec
+								== task->ItsJob->SourceStat.st_mtim.tv_sec
+						&& task->ItsJob->DestStat.st_uid
+								== task->ItsJob->SourceStat.st_uid
+						&& task->ItsJob->DestStat.st_gid
+								== task->ItsJob->SourceStat.st_gid) {
+					// Remove this job's dependencies
+					while (task->ItsJob->Dependents.size() > 0) {
+						removeDependency(*task->ItsJob->Dependents.begin(),
+								task->ItsJob);
+					}
+
+					summary.Add(*task->ItsJob, true);
+					jobsOpen.erase(task->ItsJob);
+					delete task->ItsJob;
+				}
+			}
+			if (task->Type == Task::TaskType::CHUNK) {
+				if (printProgress)
+					cout << jobsOpen.size() << " C" << task->ChunkIdx << " "
+							<< task->ItsJob->SourcePath << endl;
+				task->ItsJob->ChunkState[task->ChunkIdx] =
+						ModVerifier::Needed(*task) ?
+								Job::CopyState::WRITTEN : Job::CopyState::DONE;
+				summary.AddChunk(*task);
+			}
+			if (task->Type == Task::TaskType::VERIFY) {
+				if (printProgress)
+					cout << jobsOpen.size() << " V" << task->ChunkIdx
+							<< (task->Mismatch ? " mismatch " : " ")
+							<< task->ItsJob->SourcePath << endl;
+				summary.AddVerify(*task);
+				Job *job = task->ItsJob;
+				// Rewrite a mismatching chunk until it runs out of retries
+				if (task->Mismatch
+						&& ++job->ChunkMismatches[task->ChunkIdx]
+								<= ModVerifier::MaxRetries)
+					job->ChunkState[task->ChunkIdx] = Job::CopyState::OPEN;
+				else {
+					job->Log.ErrorVerifyChunk[task->ChunkIdx] = task->Mismatch;
+					job->ChunkState[task->ChunkIdx] = Job::CopyState::DONE;
+				}
+			}
+			if (task->Type == Task::TaskType::ATTRIBUTES) {
+				if (printProgress)
+					cout << jobsOpen.size() << " A " << task->ItsJob->SourcePath
+							<< endl;
+				// Remove this job's dependencies
+				while (task->ItsJob->Dependents.size() > 0) {
+					removeDependency(*task->ItsJob->Dependents.begin(),
+							task->ItsJob);
+				}
+				//Mark attributes as finished (not really necessary because job will be deleted immediatelly)
+				task->ItsJob->AttribState = Job::CopyState::DONE;
+				// Delete the job
+				summary.Add(*task->ItsJob, false);
+				jobsOpen.erase(task->ItsJob);
+				delete task->ItsJob;
+			}
+
+			delete task;
+			continue;
+		}
+
+		// Nothing can be scheduled while both queues are full
+		openFull = TasksOpen.Size() >= queueSize;
+		verifyFull = verifiers.empty() || TasksVerify.Size() >= queueSize;
+		idle = true;
+		if (openFull && verifyFull)
+			continue;
+
+		// Try to continue on an open job. The balanced policy alternates
+		// between the biggest and the smallest jobs.
+		reverse = schedulingPolicy == SchedulingPolicy::BALANCED && !reverse;
+		if (reverse) {
+			for (auto job = jobsOpen.rbegin(); job != jobsOpen.rend(); job++)
+				if (scheduleTask(*job)) {
+					idle = false;
+					break;
+				}
+		} else {
+			for (Job *job : jobsOpen)
+				if (scheduleTask(job)) {
+					idle = false;
+					break;
+				}
+		}
+	}
+
+	// == Cleanup ==
+
+	assert(TasksOpen.Size() == 0);
+	for (const auto &queue : tasksRead)
+		assert(queue.second->Size() == 0);
+	assert(TasksWritten.Size() == 0);
+	assert(TasksVerify.Size() == 0);
+
+	// Readers
+	for (ModReader *reader : readers)
+		reader->Stop();
+	for (ModReader *reader : readers)
+		TasksOpen.PushBack(nullptr);
+	for (ModReader *reader : readers)
+		delete reader;
+
+	// Writers
+	for (ModWriter *writer : writers)
+		writer->Stop();
+	for (ModWriter *writer : writers)
+		writer->In->PushBack(nullptr);
+	for (ModWriter *writer : writers)
+		delete writer;
+	for (const auto &queue : tasksRead)
+		delete queue.second;
+
+	// Verifiers
+	for (ModVerifier *verifier : verifiers)
+		verifier->Stop();
+	for (ModVerifier *verifier : verifiers)
+		TasksVerify.PushBack(nullptr);
+	for (ModVerifier *verifier : verifiers)
+		delete verifier;
+
+	if (journal != nullptr)
+		journal->Sync();
+
+	if (pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(previousCpus),
+				&previousCpus);
+
+	return summary;
+}
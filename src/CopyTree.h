@@ -0,0 +1,66 @@
+#ifndef SRC_COPYTREE_H_
+#define SRC_COPYTREE_H_
+
+#include "Summary.h"
+
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Order in which the central scheduling loop picks the next task among all
+ * open jobs. Jobs whose size is not known yet always come first for the size
+ * aware policies.
+ */
+enum struct SchedulingPolicy {
+	/// Source path order, which keeps the accesses local.
+	PATH,
+	/// Largest files first, such that a big file does not finish last.
+	LPT,
+	/// Smallest files first for quick visible progress.
+	SMALL_FIRST,
+	/// Alternately the largest and the smallest file.
+	BALANCED
+};
+
+/**
+ * Whether written chunks are read back from the destination and compared
+ * with the hash of the data read from the source.
+ */
+enum struct VerifyMode {
+	OFF,
+	/// Read back through the page cache, which may serve the data just written.
+	CACHED,
+	/// Read back with O_DIRECT where the destination supports it.
+	DIRECT
+};
+
+/// Reads path, lpt, small-first or balanced. Returns false for other names.
+bool parseSchedulingPolicy(const std::string &name, SchedulingPolicy &policy);
+/// Inverse of parseSchedulingPolicy().
+const char* schedulingPolicyName(SchedulingPolicy policy);
+
+/**
+ * Makes pathOut similar to pathIn by running the reader and writer pipeline
+ * until all jobs are finished. If workStealing is set, the tasks are executed
+ * by work stealing threads instead of the central scheduling loop, which
+ * picks the tasks according to schedulingPolicy. Unless verifyMode is OFF,
+ * every chunk is verified after writing and rewritten on a mismatch.
+ * @param recursive If false, the contents of a source directory are not
+ * copied. Only the directory itself is created, cleaned from entries which
+ * are not in the source and gets its attributes set.
+ * @returns The aggregated logs of all jobs.
+ */
+Summary copyTree(const std::filesystem::path &pathIn,
+		const std::filesystem::path &pathOut, bool recursive = true);
+
+/**
+ * Copies several independent entries (pairs of source and destination path)
+ * with a single pipeline, as if each was passed to copyTree() on its own.
+ */
+Summary copyTree(
+		const std::vector<std::pair<std::filesystem::path,
+				std::filesystem::path>> &entries, bool recursive = true);
+
+#endif /* SRC_COPYTREE_H_ */
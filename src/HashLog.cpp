@@ -0,0 +1,47 @@
+#include "HashLog.h"
+
+#include "ChunkHash.h"
+#include "Job.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+
+using namespace std;
+
+extern size_t chunkSize;
+
+HashLog *hashLog = nullptr;
+
+HashLog::HashLog() :
+		fd(-1) {
+}
+
+HashLog::~HashLog() {
+	if (fd >= 0) {
+		fdatasync(fd);
+		close(fd);
+	}
+}
+
+bool HashLog::Open(const filesystem::path &path) {
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return false;
+	string header = string("# fastsync chunk hashes ") + chunkHashName + "\n";
+	return write(fd, header.data(), header.size()) == (ssize_t) header.size();
+}
+
+void HashLog::ChunkHashed(const Job &job, size_t chunkIdx, size_t length,
+		uint64_t hash) {
+	char prefix[64];
+	snprintf(prefix, sizeof(prefix), "%016" PRIx64 " %zu %zu ", hash,
+			chunkIdx * chunkSize, length);
+	string line = prefix + job.DestPath.string() + "\n";
+	// One write per line keeps the lines of concurrent writers apart
+	if (write(fd, line.data(), line.size()) != (ssize_t) line.size())
+		perror("Writing hash log");
+}
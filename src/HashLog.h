@@ -0,0 +1,39 @@
+#ifndef SRC_HASHLOG_H_
+#define SRC_HASHLOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+struct Job;
+
+/**
+ * Append-only list of the hashes of all chunks that were written (or
+ * verified, in verify mode), for auditing the destination later.
+ * After a header naming the hash, every line holds
+ * <hash in hex> <offset> <length> <destination path>.
+ * Every line is written with a single write() on an O_APPEND descriptor, so
+ * several processes can share one file.
+ */
+class HashLog {
+	int fd;
+
+public:
+	HashLog();
+	~HashLog();
+
+	/**
+	 * Opens the file for appending and writes the header.
+	 * @returns false if the file cannot be opened.
+	 */
+	bool Open(const std::filesystem::path &path);
+
+	/// Records the hash of a chunk of the job. Can be called from any thread.
+	void ChunkHashed(const Job &job, size_t chunkIdx, size_t length,
+			uint64_t hash);
+};
+
+/// Hash log used by the writers and verifiers, nullptr if none is kept.
+extern HashLog *hashLog;
+
+#endif /* SRC_HASHLOG_H_ */
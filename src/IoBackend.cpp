@@ -0,0 +1,224 @@
+#include "IoBackend.h"
+
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+static PosixBackend posixBackend;
+
+IoBackend *sourceBackend = &posixBackend;
+IoBackend *destBackend = &posixBackend;
+
+size_t directoryHandleLimit = 256;
+
+/// Number of directories currently held open by a DirHandle.
+static atomic<size_t> openDirectories(0);
+
+void raiseDescriptorLimit() {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+		return;
+	if (limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
+			getrlimit(RLIMIT_NOFILE, &limit);
+	}
+	// Leave the other half to files and sockets
+	if (limit.rlim_cur != RLIM_INFINITY)
+		directoryHandleLimit = limit.rlim_cur / 2;
+}
+
+DirHandle::~DirHandle() {
+	if (Fd >= 0) {
+		Backend->Close(Fd);
+		openDirectories--;
+	}
+}
+
+IoBackend::~IoBackend() {
+}
+
+shared_ptr<DirHandle> IoBackend::OpenDirectory(const DirHandle *dir,
+		const string &name) {
+	int fd = -1;
+	if (++openDirectories <= directoryHandleLimit)
+		fd = Open(dir, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		openDirectories--;
+	return make_shared<DirHandle>(this, fd, entryPath(dir, name));
+}
+
+filesystem::path IoBackend::entryPath(const DirHandle *dir,
+		const string &name) {
+	if (dir == nullptr)
+		return name;
+	return dir->EntryPath(name);
+}
+
+int PosixBackend::resolve(const DirHandle *dir, const string &name,
+		string &at) {
+	if (dir != nullptr && dir->Fd >= 0) {
+		at = name;
+		return dir->Fd;
+	}
+	at = entryPath(dir, name);
+	return AT_FDCWD;
+}
+
+/// Copies the fields fastsync uses from a statx result.
+static void fromStatx(const struct statx &sx, struct stat *buf) {
+	memset(buf, 0, sizeof(*buf));
+	buf->st_mode = sx.stx_mode;
+	buf->st_uid = sx.stx_uid;
+	buf->st_gid = sx.stx_gid;
+	buf->st_ino = sx.stx_ino;
+	buf->st_size = sx.stx_size;
+	buf->st_atim.tv_sec = sx.stx_atime.tv_sec;
+	buf->st_atim.tv_nsec = sx.stx_atime.tv_nsec;
+	buf->st_mtim.tv_sec = sx.stx_mtime.tv_sec;
+	buf->st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+}
+
+int PosixBackend::Stat(const DirHandle *dir, const string &name,
+		struct stat *buf, unsigned int mask) {
+	string at;
+	int dirfd = resolve(dir, name, at);
+	struct statx sx;
+	if (statx(dirfd, at.c_str(), AT_SYMLINK_NOFOLLOW, mask, &sx) != 0) {
+		memset(buf, 0, sizeof(*buf));
+		return -1;
+	}
+	fromStatx(sx, buf);
+	return 0;
+}
+
+int PosixBackend::Fstat(int fd, struct stat *buf, unsigned int mask) {
+	struct statx sx;
+	if (statx(fd, "", AT_EMPTY_PATH, mask, &sx) != 0) {
+		memset(buf, 0, sizeof(*buf));
+		return -1;
+	}
+	fromStatx(sx, buf);
+	return 0;
+}
+
+int PosixBackend::Open(const DirHandle *dir, const string &name, int flags,
+		mode_t mode) {
+	string at;
+	int dirfd = resolve(dir, name, at);
+	return openat(dirfd, at.c_str(), flags, mode);
+}
+
+int PosixBackend::Close(int fd) {
+	return close(fd);
+}
+
+ssize_t PosixBackend::Pread(int fd, void *buf, size_t count, off_t offset) {
+	return pread(fd, buf, count, offset);
+}
+
+ssize_t PosixBackend::Write(int fd, const void *buf, size_t count) {
+	return write(fd, buf, count);
+}
+
+ssize_t PosixBackend::Pwrite(int fd, const void *buf, size_t count,
+		off_t offset) {
+	return pwrite(fd, buf, count, offset);
+}
+
+int PosixBackend::Truncate(int fd, off_t length) {
+	return ftruncate(fd, length);
+}
+
+ssize_t PosixBackend::ReadLink(const DirHandle *dir, const string &name,
+		char *buf, size_t size) {
+	string at;
+	int dirfd = resolve(dir, name, at);
+	return readlinkat(dirfd, at.c_str(), buf, size);
+}
+
+int PosixBackend::Symlink(const char *target, const DirHandle *dir,
+		const string &name) {
+	string at;
+	int dirfd = resolve(dir, name, at);
+	return symlinkat(target, dirfd, at.c_str());
+}
+
+int PosixBackend::Mkdir(const DirHandle *dir, const string &name,
+		mode_t mode) {
+	string at;
+	int dirfd = resolve(dir, name, at);
+	return mkdirat(dirfd, at.c_str(), mode);
+}
+
+int PosixBackend::SetTimes(const DirHandle *dir, const string &name,
+		const struct timespec times[2]) {
+	string at;
+	int dirfd = resolve(dir, name, at);
+	return utimensat(dirfd, at.c_str(), times, AT_SYMLINK_NOFOLLOW);
+}
+
+int PosixBackend::Chown(const DirHandle *dir, const string &name, uid_t uid,
+		gid_t gid) {
+	string at;
+	int dirfd = resolve(dir, name, at);
+	return fchownat(dirfd, at.c_str(), uid, gid, AT_SYMLINK_NOFOLLOW);
+}
+
+int PosixBackend::Chmod(const DirHandle *dir, const string &name,
+		mode_t mode) {
+	string at;
+	int dirfd = resolve(dir, name, at);
+	return fchmodat(dirfd, at.c_str(), mode, 0);
+}
+
+int PosixBackend::Futimens(int fd, const struct timespec times[2]) {
+	return futimens(fd, times);
+}
+
+int PosixBackend::Fchown(int fd, uid_t uid, gid_t gid) {
+	return fchown(fd, uid, gid);
+}
+
+int PosixBackend::Fchmod(int fd, mode_t mode) {
+	return fchmod(fd, mode);
+}
+
+bool PosixBackend::RemoveAll(const DirHandle *dir, const string &name) {
+	std::error_code ec;
+	filesystem::remove_all(entryPath(dir, name), ec);
+	return ec.value() == 0;
+}
+
+bool PosixBackend::ListDirectory(const DirHandle &dir, vector<string> &names) {
+	if (dir.Fd < 0) {
+		std::error_code ec;
+		for (const auto &entry : filesystem::directory_iterator(dir.Path, ec))
+			names.push_back(entry.path().filename());
+		return ec.value() == 0;
+	}
+
+	// Read through a description of its own: closedir() closes the descriptor
+	// and the position must not be shared with other readers of the directory
+	int fd = openat(dir.Fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *stream = fd < 0 ? nullptr : fdopendir(fd);
+	if (stream == nullptr) {
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	errno = 0;
+	while (struct dirent *entry = readdir(stream)) {
+		if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+			names.push_back(entry->d_name);
+	}
+	bool success = errno == 0;
+	closedir(stream);
+	return success;
+}
@@ -0,0 +1,159 @@
+#ifndef SRC_IOBACKEND_H_
+#define SRC_IOBACKEND_H_
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+class IoBackend;
+
+/// statx fields that fastsync compares or copies.
+const unsigned int StatMaskAttributes = STATX_TYPE | STATX_MODE | STATX_UID
+		| STATX_GID | STATX_ATIME | STATX_MTIME | STATX_INO | STATX_SIZE;
+
+/**
+ * Open directory that entries are addressed relative to, so the path of the
+ * directory is not resolved again for every operation. If the directory
+ * could not be opened (e.g. because the process ran out of descriptors), Fd
+ * is -1 and entries are addressed by their full path instead.
+ */
+struct DirHandle {
+	int Fd;
+	std::filesystem::path Path;
+	IoBackend *Backend;
+
+	DirHandle(IoBackend *backend, int fd, const std::filesystem::path &path) :
+			Fd(fd), Path(path), Backend(backend) {
+	}
+	/// Closes the directory.
+	~DirHandle();
+
+	/// Full path of an entry of this directory.
+	std::filesystem::path EntryPath(const std::string &name) const {
+		return Path / name;
+	}
+};
+
+/**
+ * Filesystem operations used by the modules. All functions behave like their
+ * POSIX counterparts: they return -1 (or false) on error and set errno.
+ * Entries are addressed by a directory and a name. If the directory is
+ * nullptr, the name is a path relative to the working directory.
+ */
+class IoBackend {
+public:
+	virtual ~IoBackend();
+
+	/**
+	 * Stats an entry without following symlinks and only asks for the fields
+	 * in mask. On error, buf is zeroed.
+	 */
+	virtual int Stat(const DirHandle *dir, const std::string &name,
+			struct stat *buf, unsigned int mask = StatMaskAttributes) = 0;
+	/// Stats an open file or directory. On error, buf is zeroed.
+	virtual int Fstat(int fd, struct stat *buf, unsigned int mask =
+			StatMaskAttributes) = 0;
+	virtual int Open(const DirHandle *dir, const std::string &name, int flags,
+			mode_t mode = 0) = 0;
+	virtual int Close(int fd) = 0;
+	virtual ssize_t Pread(int fd, void *buf, size_t count, off_t offset) = 0;
+	virtual ssize_t Write(int fd, const void *buf, size_t count) = 0;
+	virtual ssize_t Pwrite(int fd, const void *buf, size_t count,
+			off_t offset) = 0;
+	virtual int Truncate(int fd, off_t length) = 0;
+	virtual ssize_t ReadLink(const DirHandle *dir, const std::string &name,
+			char *buf, size_t size) = 0;
+	virtual int Symlink(const char *target, const DirHandle *dir,
+			const std::string &name) = 0;
+	virtual int Mkdir(const DirHandle *dir, const std::string &name,
+			mode_t mode) = 0;
+	/// Sets atime and mtime without following symlinks.
+	virtual int SetTimes(const DirHandle *dir, const std::string &name,
+			const struct timespec times[2]) = 0;
+	/// Changes the owner without following symlinks.
+	virtual int Chown(const DirHandle *dir, const std::string &name, uid_t uid,
+			gid_t gid) = 0;
+	virtual int Chmod(const DirHandle *dir, const std::string &name,
+			mode_t mode) = 0;
+	virtual int Futimens(int fd, const struct timespec times[2]) = 0;
+	virtual int Fchown(int fd, uid_t uid, gid_t gid) = 0;
+	virtual int Fchmod(int fd, mode_t mode) = 0;
+	/// Removes a filesystem object recursively.
+	virtual bool RemoveAll(const DirHandle *dir, const std::string &name) = 0;
+	/// Lists the names of all entries of a directory.
+	virtual bool ListDirectory(const DirHandle &dir,
+			std::vector<std::string> &names) = 0;
+
+	/**
+	 * Opens a directory without following symlinks. Always returns a handle,
+	 * which falls back to paths if the directory could not be opened.
+	 */
+	std::shared_ptr<DirHandle> OpenDirectory(const DirHandle *dir,
+			const std::string &name);
+
+protected:
+	/// Full path of an entry.
+	static std::filesystem::path entryPath(const DirHandle *dir,
+			const std::string &name);
+};
+
+/**
+ * Passes all operations directly to the kernel.
+ */
+class PosixBackend: public IoBackend {
+	/// Returns the descriptor to pass to a *at() call and sets at to the name.
+	static int resolve(const DirHandle *dir, const std::string &name,
+			std::string &at);
+public:
+	int Stat(const DirHandle *dir, const std::string &name, struct stat *buf,
+			unsigned int mask = StatMaskAttributes) override;
+	int Fstat(int fd, struct stat *buf, unsigned int mask = StatMaskAttributes)
+			override;
+	int Open(const DirHandle *dir, const std::string &name, int flags,
+			mode_t mode = 0) override;
+	int Close(int fd) override;
+	ssize_t Pread(int fd, void *buf, size_t count, off_t offset) override;
+	ssize_t Write(int fd, const void *buf, size_t count) override;
+	ssize_t Pwrite(int fd, const void *buf, size_t count, off_t offset)
+			override;
+	int Truncate(int fd, off_t length) override;
+	ssize_t ReadLink(const DirHandle *dir, const std::string &name, char *buf,
+			size_t size) override;
+	int Symlink(const char *target, const DirHandle *dir,
+			const std::string &name) override;
+	int Mkdir(const DirHandle *dir, const std::string &name, mode_t mode)
+			override;
+	int SetTimes(const DirHandle *dir, const std::string &name,
+			const struct timespec times[2]) override;
+	int Chown(const DirHandle *dir, const std::string &name, uid_t uid,
+			gid_t gid) override;
+	int Chmod(const DirHandle *dir, const std::string &name, mode_t mode)
+			override;
+	int Futimens(int fd, const struct timespec times[2]) override;
+	int Fchown(int fd, uid_t uid, gid_t gid) override;
+	int Fchmod(int fd, mode_t mode) override;
+	bool RemoveAll(const DirHandle *dir, const std::string &name) override;
+	bool ListDirectory(const DirHandle &dir, std::vector<std::string> &names)
+			override;
+};
+
+/// Backend used by the readers. Defaults to a PosixBackend.
+extern IoBackend *sourceBackend;
+/// Backend used by the writers. Defaults to a PosixBackend.
+extern IoBackend *destBackend;
+
+/// Maximum number of directories held open by DirHandles at the same time.
+extern size_t directoryHandleLimit;
+
+/**
+ * Raises the soft limit of open descriptors to the hard limit and lets
+ * DirHandles use half of it.
+ */
+void raiseDescriptorLimit();
+
+#endif /* SRC_IOBACKEND_H_ */
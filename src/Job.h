@@ -2,11 +2,18 @@
 #define SRC_JOB_H_
 
 #include <filesystem>
+#include <memory>
+#include <string>
 #include <vector>
 #include <sys/stat.h>
 #include <set>
 #include <cstring>
 #include <cassert>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+struct DirHandle;
 
 /**
  * Represents a filesystem item that should be copied.
@@ -18,6 +25,15 @@ struct Job {
 	/// Path to the destination.
 	std::filesystem::path DestPath;
 
+	/// Name of the entry in SourceParent and DestParent.
+	std::string Name;
+	/// Open directories containing the source and the destination. nullptr
+	/// for the root job, which is addressed by its paths.
+	std::shared_ptr<DirHandle> SourceParent, DestParent;
+	/// Open source and destination of a directory job, the parents of its
+	/// children.
+	std::shared_ptr<DirHandle> SourceDir, DestDir;
+
 	/// Current stat of the source.
 	struct stat SourceStat;
 	/// Stat of the destination. Must be updated whenever dest is changed.
@@ -25,15 +41,28 @@ struct Job {
 
 	/// Copy state only reflects position in the pipeline, not errors.
 	enum struct CopyState {
-		OPEN, SCHEDULED, DONE
+		OPEN, SCHEDULED,
+		/// Chunk written, but not verified yet (verify mode only).
+		WRITTEN,
+		/// Chunk is being verified (verify mode only).
+		VERIFYING, DONE
 	};
 
 	/// State of the initialization
 	CopyState InitState;
 	/// State of the individual chunks for regular files
 	std::vector<CopyState> ChunkState;
+	/// Hashes of the chunk data read from the source, if chunks are verified
+	/// or hashes are logged.
+	std::vector<uint64_t> ChunkHashes;
+	/// Number of verifications of each chunk that found a mismatch. A chunk
+	/// with mismatches is rewritten in place instead of appended.
+	std::vector<unsigned> ChunkMismatches;
 	/// State of the attributes
 	CopyState AttribState;
+	/// True if the attributes were already set through the descriptor the
+	/// last chunk was written with.
+	bool AttribApplied;
 
 	/// Lists all jobs that have to be finished before a directory can be finalized
 	/// (deleting content that is not in the source dir and setting attributes).
@@ -42,6 +71,32 @@ struct Job {
 	/// Lists all jobs that can only be executed when this job is finished.
 	std::set<Job*> Dependents;
 
+	/// Size the central scheduling loop orders the job by. Must only be changed
+	/// while the job is not in the ordered set of open jobs.
+	uint64_t SchedulingSize;
+	static const uint64_t UnknownSize = (uint64_t) -1;
+
+	/// Directory job this job was created for (work stealing mode only).
+	Job *Parent;
+	/// Number of children (plus one while they are being created) which must
+	/// be finished before the attributes of this directory can be set
+	/// (work stealing mode only).
+	std::atomic<size_t> PendingChildren;
+	/// Chunk sequence (one) plus verifications which must be finished before
+	/// the attributes can be set (work stealing verify mode only).
+	std::atomic<size_t> PendingVerifies;
+
+	/// Descriptor the verifiers read the destination back through, opened by
+	/// the first verification and closed before the attributes are set
+	/// (verify mode only). Guarded by VerifyFdMutex, the reads are not.
+	int VerifyFd;
+	/// True if VerifyFd bypasses the page cache.
+	bool VerifyDirect;
+	/// O_DIRECT descriptor which was replaced by a buffered one because a read
+	/// failed. Other verifiers may still use it, so it is closed with VerifyFd.
+	int VerifyDirectFailedFd;
+	std::mutex VerifyFdMutex;
+
 	/**
 	 * Log only reflects what to reflect to the user and should not be used
 	 * as input for later pipeline stages.
@@ -52,28 +107,58 @@ struct Job {
 		bool ErrorReadLink;
 		bool ErrorDeleteOld;
 		bool ErrorCreateDest;
-		std::vector<bool> ErrorReadChunk;
-		std::vector<bool> ErrorWriteChunk;
+		// Chunks of a file can be in different stages at the same time, so
+		// these are not vector<bool>
+		std::vector<char> ErrorReadChunk;
+		std::vector<char> ErrorWriteChunk;
+		/// Chunks which still did not match the source after all retries.
+		std::vector<char> ErrorVerifyChunk;
 		bool ErrorDeleteDirContents;
 		bool ErrorSetTimes;
 		bool ErrorSetOwner;
 		bool ErrorSetMode;
+		/// Number of chunks which were already written by an interrupted run.
+		size_t ResumedChunks;
 
 		Log() :
 				ErrorStatSource(false), ErrorSourceType(false), ErrorReadLink(
 						false), ErrorDeleteOld(false), ErrorCreateDest(false), ErrorDeleteDirContents(
 						false), ErrorSetTimes(false), ErrorSetOwner(false), ErrorSetMode(
-						false) {
+						false), ResumedChunks(0) {
 		}
 	} Log;
 
 	Job() :
-			InitState(CopyState::OPEN), AttribState(CopyState::OPEN) {
+			InitState(CopyState::OPEN), AttribState(CopyState::OPEN), AttribApplied(
+					false), SchedulingSize(UnknownSize), Parent(nullptr), PendingChildren(
+					0), PendingVerifies(0), VerifyFd(-1), VerifyDirect(false), VerifyDirectFailedFd(
+					-1) {
 		memset(&SourceStat, 0, sizeof(SourceStat));
 		memset(&DestStat, 0, sizeof(DestStat));
 	}
+
+	/// Name of the source relative to SourceParent.
+	std::string SourceName() const {
+		return SourceParent ? Name : SourcePath.string();
+	}
+
+	/// Name of the destination relative to DestParent.
+	std::string DestName() const {
+		return DestParent ? Name : DestPath.string();
+	}
 };
 
+/// Creates the job for the entry name of the directory job parent.
+inline Job* createSubJob(const Job *parent, const std::string &name) {
+	Job *subJob = new Job();
+	subJob->SourcePath = parent->SourcePath / name;
+	subJob->DestPath = parent->DestPath / name;
+	subJob->Name = name;
+	subJob->SourceParent = parent->SourceDir;
+	subJob->DestParent = parent->DestDir;
+	return subJob;
+}
+
 inline void createDependency(Job *dependent, Job *independent) {
 	assert(
 			dependent->FinishDirDependencies.find(independent)
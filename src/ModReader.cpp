@@ -3,6 +3,11 @@
 #include "Job.h"
 #include "Task.h"
 #include "ThreadsafeBuffer.h"
+#include "IoBackend.h"
+#include "ThreadPlacement.h"
+#include "ChunkHash.h"
+#include "HashLog.h"
+#include "CopyTree.h"
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -11,65 +16,96 @@
 using namespace std;
 
 extern size_t chunkSize;
+extern VerifyMode verifyMode;
 
-void ModReader::run() {
-	// Read in elements from the input and put them to the output
-	while (!stop) {
-		Task *task = In->PopFront();
-		if (task == nullptr)
-			continue;
+void ModReader::Execute(Task *task, int bufferNode) {
+	if (task->Type == Task::TaskType::INIT) {
+		// Read stat
+		task->ItsJob->Log.ErrorStatSource = sourceBackend->Stat(
+				task->ItsJob->SourceParent.get(), task->ItsJob->SourceName(),
+				&task->ItsJob->SourceStat) != 0;
+		// Check type
+		if (!S_ISREG(task->ItsJob->SourceStat.st_mode) &&
+		!S_ISDIR(task->ItsJob->SourceStat.st_mode) &&
+		!S_ISLNK(task->ItsJob->SourceStat.st_mode))
+			task->ItsJob->Log.ErrorSourceType = true;
 
-		if (task->Type == Task::TaskType::INIT) {
-			// Read stat
-			task->ItsJob->Log.ErrorStatSource = lstat(
-					task->ItsJob->SourcePath.c_str(), &task->ItsJob->SourceStat)
-					!= 0;
-			// Check type
-			if (!S_ISREG(task->ItsJob->SourceStat.st_mode) &&
-			!S_ISDIR(task->ItsJob->SourceStat.st_mode) &&
-			!S_ISLNK(task->ItsJob->SourceStat.st_mode))
-				task->ItsJob->Log.ErrorSourceType = true;
+		// If type is regular file, resize chunks state vector of job
+		if (S_ISREG(task->ItsJob->SourceStat.st_mode)) {
+			size_t numChunks = task->ItsJob->SourceStat.st_size / chunkSize
+					+ ((task->ItsJob->SourceStat.st_size % chunkSize == 0) ?
+							0 : 1);
+			task->ItsJob->ChunkState.resize(numChunks,
+					Job::CopyState::OPEN);
+			task->ItsJob->Log.ErrorReadChunk.resize(numChunks, false);
+			task->ItsJob->Log.ErrorWriteChunk.resize(numChunks, false);
+			task->ItsJob->Log.ErrorVerifyChunk.resize(numChunks, false);
+			task->ItsJob->ChunkHashes.resize(numChunks, 0);
+			task->ItsJob->ChunkMismatches.resize(numChunks, 0);
+		}
 
-			// If type is regular file, resize chunks state vector of job
-			if (S_ISREG(task->ItsJob->SourceStat.st_mode)) {
-				size_t numChunks = task->ItsJob->SourceStat.st_size / chunkSize
-						+ ((task->ItsJob->SourceStat.st_size % chunkSize == 0) ?
-								0 : 1);
-				task->ItsJob->ChunkState.resize(numChunks,
-						Job::CopyState::OPEN);
-				task->ItsJob->Log.ErrorReadChunk.resize(numChunks, false);
-				task->ItsJob->Log.ErrorWriteChunk.resize(numChunks, false);
-			}
+		// If type is directory, keep it open for its contents
+		if (S_ISDIR(task->ItsJob->SourceStat.st_mode))
+			task->ItsJob->SourceDir = sourceBackend->OpenDirectory(
+					task->ItsJob->SourceParent.get(),
+					task->ItsJob->SourceName());
 
-			// If type is link, copy content
-			if (S_ISLNK(task->ItsJob->SourceStat.st_mode)) {
-				task->data.resize(4097);
-				size_t linkTgtSize = readlinkat(AT_FDCWD,
-						task->ItsJob->SourcePath.c_str(), &task->data[0], 4096);
-				if (linkTgtSize == -1) {
-					task->data.resize(0);
-					task->ItsJob->Log.ErrorReadLink = true;
-				}
+		// If type is link, copy content
+		if (S_ISLNK(task->ItsJob->SourceStat.st_mode)) {
+			task->data.resize(4097);
+			ssize_t linkTgtSize = sourceBackend->ReadLink(
+					task->ItsJob->SourceParent.get(),
+					task->ItsJob->SourceName(), &task->data[0], 4096);
+			if (linkTgtSize == -1) {
+				task->data.resize(0);
+				task->ItsJob->Log.ErrorReadLink = true;
+			} else {
 				task->data[linkTgtSize] = 0;
 				task->data.resize(linkTgtSize + 1);
 			}
-		} else if (task->Type == Task::TaskType::CHUNK) {
-			size_t startPos = task->ChunkIdx * chunkSize;
-			size_t currentChunkSize = min(chunkSize,
-					task->ItsJob->SourceStat.st_size - startPos);
-
-			int fd = open(task->ItsJob->SourcePath.c_str(),
-					O_RDONLY | O_NOFOLLOW);
-			lseek(fd, startPos, SEEK_SET);
-			task->data.resize(currentChunkSize);
-			task->ItsJob->Log.ErrorReadChunk[task->ChunkIdx] = read(fd,
-					&task->data[0], currentChunkSize) == 0;
-			close(fd);
-		} else if (task->Type == Task::TaskType::ATTRIBUTES) {
-			// Attributes were already read during init stat
-			// -> Nothing to do
 		}
+	} else if (task->Type == Task::TaskType::CHUNK) {
+		size_t startPos = task->ChunkIdx * chunkSize;
+		size_t currentChunkSize = min(chunkSize,
+				task->ItsJob->SourceStat.st_size - startPos);
+
+		int fd = sourceBackend->Open(task->ItsJob->SourceParent.get(),
+				task->ItsJob->SourceName(), O_RDONLY | O_NOFOLLOW);
+		// Place the pages where the data is consumed before touching them
+		task->data.reserve(currentChunkSize);
+		preferNode(task->data.data(), currentChunkSize, bufferNode);
+		task->BufferNode = bufferNode;
+		task->data.resize(currentChunkSize);
+		task->ItsJob->Log.ErrorReadChunk[task->ChunkIdx] = fd < 0
+				|| sourceBackend->Pread(fd, &task->data[0], currentChunkSize,
+						startPos) <= 0;
+		if (fd >= 0)
+			sourceBackend->Close(fd);
+		// Hash while the data is in the cache, for the verifier or the log
+		if (!task->ItsJob->Log.ErrorReadChunk[task->ChunkIdx]
+				&& (verifyMode != VerifyMode::OFF || hashLog != nullptr))
+			task->ItsJob->ChunkHashes[task->ChunkIdx] = hashChunk(
+					&task->data[0], currentChunkSize);
+	} else if (task->Type == Task::TaskType::ATTRIBUTES) {
+		// Attributes were already read during init stat
+		// -> Nothing to do
+	}
+}
+
+void ModReader::run() {
+	// Read in elements from the input and put them to the output
+	while (!stop) {
+		Task *task = In->PopFront();
+		if (task == nullptr)
+			continue;
+
+		Execute(task, OutNode >= 0 ? OutNode : Node());
 
-		Out->PushBack(task);
+		// Prefer the writers the data was placed for
+		bool pushed = Out->TryPushBack(task);
+		for (size_t o = 0; !pushed && o < Overflow.size(); o++)
+			pushed = Overflow[o]->TryPushBack(task);
+		if (!pushed)
+			Out->PushBack(task);
 	}
 }
@@ -3,6 +3,8 @@
 
 #include "ThreadedModule.h"
 
+#include <vector>
+
 template<typename Type>
 class ThreadsafeBuffer;
 struct Task;
@@ -10,6 +12,22 @@ struct Task;
 struct ModReader: ThreadedModule {
 	ThreadsafeBuffer<Task> *In;
 	ThreadsafeBuffer<Task> *Out;
+	/// Buffers tasks are passed to when Out is full.
+	std::vector<ThreadsafeBuffer<Task>*> Overflow;
+	/// NUMA node of the writers behind Out, -1 if unknown.
+	int OutNode;
+
+	ModReader() :
+			In(nullptr), Out(nullptr), OutNode(-1) {
+	}
+
+	/**
+	 * Reads the source side of a task: stats the source, reads link targets
+	 * and chunk data into the task. Can be called from any thread.
+	 * @param bufferNode NUMA node to place chunk data on, -1 for the node
+	 * of the calling thread.
+	 */
+	static void Execute(Task *task, int bufferNode = -1);
 protected:
 	virtual void run() override;
 };
@@ -0,0 +1,239 @@
+#include "ModStealer.h"
+
+#include "Job.h"
+#include "Task.h"
+#include "WorkDeque.h"
+#include "ModReader.h"
+#include "ModWriter.h"
+#include "ModVerifier.h"
+#include "CopyTree.h"
+#include "IoBackend.h"
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+extern bool printProgress;
+extern VerifyMode verifyMode;
+
+/// Serializes the progress output of all threads.
+static mutex outputMutex;
+
+void StealingContext::Push(size_t deque, Task *task) {
+	Deques[deque]->PushBack(task);
+	QueuedTasks++;
+	if (Sleepers > 0) {
+		lock_guard<mutex> lock(IdleMutex);
+		WorkAvailable.notify_one();
+	}
+}
+
+void ModStealer::onStop() {
+	lock_guard<mutex> lock(Context->IdleMutex);
+	Context->WorkAvailable.notify_all();
+}
+
+Task* ModStealer::nextTask() {
+	Task *task = Context->Deques[Index]->PopBack();
+	for (size_t d = 1; task == nullptr && d < Context->Deques.size(); d++)
+		task = Context->Deques[(Index + d) % Context->Deques.size()]->Steal();
+	if (task != nullptr)
+		Context->QueuedTasks--;
+	return task;
+}
+
+void ModStealer::run() {
+	while (!stop) {
+		Task *task = nextTask();
+		if (task == nullptr) {
+			// Sleep until some thread pushes work. The timeout only guards
+			// against a missed wakeup.
+			unique_lock<mutex> lock(Context->IdleMutex);
+			Context->Sleepers++;
+			Context->WorkAvailable.wait_for(lock, chrono::milliseconds(10),
+					[this] {
+						return stop || Context->QueuedTasks > 0;
+					});
+			Context->Sleepers--;
+			continue;
+		}
+
+		if (task->Type == Task::TaskType::VERIFY) {
+			// Verifying only reads the destination
+			Context->WriteSlots.Acquire();
+			ModVerifier::Execute(task);
+			Context->WriteSlots.Release();
+		} else {
+			Context->ReadSlots.Acquire();
+			ModReader::Execute(task, Node());
+			Context->ReadSlots.Release();
+
+			Context->WriteSlots.Acquire();
+			ModWriter::Execute(task);
+			task->WriterNode = Node();
+			Context->WriteSlots.Release();
+		}
+
+		complete(task);
+	}
+}
+
+void ModStealer::complete(Task *task) {
+	Job *job = task->ItsJob;
+
+	if (task->Type == Task::TaskType::INIT) {
+		if (printProgress) {
+			lock_guard<mutex> lock(outputMutex);
+			cout << Context->LiveJobs << " I " << job->SourcePath << endl;
+		}
+		job->InitState = Job::CopyState::DONE;
+
+		// For links and files, check if copy has to continue at all. A file
+		// finished during init was written by this run and matches anyway.
+		if (!job->AttribApplied
+				&& (S_ISREG(job->DestStat.st_mode)
+						|| S_ISLNK(job->DestStat.st_mode))
+				&& job->DestStat.st_size == job->SourceStat.st_size
+				&& job->DestStat.st_mtim.tv_sec
+						== job->SourceStat.st_mtim.tv_sec
+				&& job->DestStat.st_uid == job->SourceStat.st_uid
+				&& job->DestStat.st_gid == job->SourceStat.st_gid) {
+			finishJob(job, true);
+		} else if (Context->Recursive && S_ISDIR(job->SourceStat.st_mode)) {
+			// Start jobs for the directory contents. The extra pending child
+			// keeps the children from finishing the directory before all of
+			// them are created.
+			job->PendingChildren = 1;
+			vector<string> names;
+			sourceBackend->ListDirectory(*job->SourceDir, names);
+			for (const string &name : names) {
+				Job *subJob = createSubJob(job, name);
+				subJob->Parent = job;
+				job->PendingChildren++;
+				Context->LiveJobs++;
+				Context->Push(Index, new Task(Task::TaskType::INIT, subJob));
+			}
+			if (--job->PendingChildren == 0)
+				Context->Push(Index, new Task(Task::TaskType::ATTRIBUTES, job));
+		} else {
+			// Start with the first chunk that was not resumed
+			size_t first = 0;
+			while (first < job->ChunkState.size()
+					&& job->ChunkState[first] == Job::CopyState::DONE)
+				first++;
+			if (first < job->ChunkState.size()) {
+				// The chunk sequence holds the attributes back until it ends
+				job->PendingVerifies = 1;
+				job->ChunkState[first] = Job::CopyState::SCHEDULED;
+				Context->Push(Index,
+						new Task(Task::TaskType::CHUNK, job, first));
+			} else {
+				Context->Push(Index,
+						new Task(Task::TaskType::ATTRIBUTES, job));
+			}
+		}
+	} else if (task->Type == Task::TaskType::CHUNK) {
+		if (printProgress) {
+			lock_guard<mutex> lock(outputMutex);
+			cout << Context->LiveJobs << " C" << task->ChunkIdx << " "
+					<< job->SourcePath << endl;
+		}
+		{
+			lock_guard<mutex> lock(Context->SummaryMutex);
+			Context->Result.AddChunk(*task);
+		}
+
+		// A rewrite takes over the pending verification of the chunk that
+		// did not match, a new chunk adds one
+		bool rewrite = job->ChunkMismatches[task->ChunkIdx] > 0;
+		if (ModVerifier::Needed(*task)) {
+			if (!rewrite)
+				job->PendingVerifies++;
+			job->ChunkState[task->ChunkIdx] = Job::CopyState::VERIFYING;
+			Context->Push(Index,
+					new Task(Task::TaskType::VERIFY, job, task->ChunkIdx));
+		} else {
+			job->ChunkState[task->ChunkIdx] = Job::CopyState::DONE;
+			if (rewrite)
+				releaseVerify(job);
+		}
+
+		// Chunks are appended to the destination: continue strictly in order.
+		// Rewrites are not part of the sequence.
+		size_t next = task->ChunkIdx + 1;
+		if (!rewrite) {
+			if (next < job->ChunkState.size()) {
+				job->ChunkState[next] = Job::CopyState::SCHEDULED;
+				Context->Push(Index,
+						new Task(Task::TaskType::CHUNK, job, next));
+			} else if (verifyMode != VerifyMode::OFF) {
+				releaseVerify(job);
+			} else {
+				Context->Push(Index, new Task(Task::TaskType::ATTRIBUTES, job));
+			}
+		}
+	} else if (task->Type == Task::TaskType::VERIFY) {
+		if (printProgress) {
+			lock_guard<mutex> lock(outputMutex);
+			cout << Context->LiveJobs << " V" << task->ChunkIdx
+					<< (task->Mismatch ? " mismatch " : " ")
+					<< job->SourcePath << endl;
+		}
+		{
+			lock_guard<mutex> lock(Context->SummaryMutex);
+			Context->Result.AddVerify(*task);
+		}
+
+		// Rewrite a mismatching chunk until it runs out of retries
+		if (task->Mismatch
+				&& ++job->ChunkMismatches[task->ChunkIdx]
+						<= ModVerifier::MaxRetries) {
+			job->ChunkState[task->ChunkIdx] = Job::CopyState::SCHEDULED;
+			Context->Push(Index,
+					new Task(Task::TaskType::CHUNK, job, task->ChunkIdx));
+		} else {
+			job->Log.ErrorVerifyChunk[task->ChunkIdx] = task->Mismatch;
+			job->ChunkState[task->ChunkIdx] = Job::CopyState::DONE;
+			releaseVerify(job);
+		}
+	} else if (task->Type == Task::TaskType::ATTRIBUTES) {
+		if (printProgress) {
+			lock_guard<mutex> lock(outputMutex);
+			cout << Context->LiveJobs << " A " << job->SourcePath << endl;
+		}
+		job->AttribState = Job::CopyState::DONE;
+		finishJob(job, false);
+	}
+
+	delete task;
+}
+
+void ModStealer::releaseVerify(Job *job) {
+	// The last one to finish triggers the attributes of the file
+	if (--job->PendingVerifies == 0)
+		Context->Push(Index, new Task(Task::TaskType::ATTRIBUTES, job));
+}
+
+void ModStealer::finishJob(Job *job, bool unchanged) {
+	{
+		lock_guard<mutex> lock(Context->SummaryMutex);
+		Context->Result.Add(*job, unchanged);
+	}
+
+	Job *parent = job->Parent;
+	delete job;
+	Context->LiveJobs--;
+
+	if (parent != nullptr) {
+		// The last child to finish triggers the attributes of its directory
+		if (--parent->PendingChildren == 0)
+			Context->Push(Index, new Task(Task::TaskType::ATTRIBUTES, parent));
+	} else if (--Context->PendingRoots == 0) {
+		lock_guard<mutex> lock(Context->IdleMutex);
+		Context->Done = true;
+		Context->DoneSignal.notify_all();
+	}
+}
@@ -0,0 +1,108 @@
+#ifndef SRC_MODSTEALER_H_
+#define SRC_MODSTEALER_H_
+
+#include "ThreadedModule.h"
+#include "Summary.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+template<typename Type>
+class WorkDeque;
+struct Task;
+struct Job;
+
+/**
+ * Limits how many threads can be in a stage at the same time.
+ */
+class StageSlots {
+	std::mutex slotsModified;
+	std::condition_variable slotReleased;
+	size_t free;
+public:
+	explicit StageSlots(size_t slots) :
+			free(slots) {
+	}
+	void Acquire() {
+		std::unique_lock<std::mutex> lock(slotsModified);
+		slotReleased.wait(lock, [this] {
+			return free > 0;
+		});
+		free--;
+	}
+	void Release() {
+		std::lock_guard<std::mutex> lock(slotsModified);
+		free++;
+		slotReleased.notify_one();
+	}
+};
+
+/**
+ * State shared by all threads of one work stealing copy run.
+ */
+struct StealingContext {
+	/// One deque per ModStealer, indexed by ModStealer::Index.
+	std::vector<WorkDeque<Task>*> Deques;
+	/// Number of tasks in all deques.
+	std::atomic<size_t> QueuedTasks;
+	/// Number of threads waiting for work.
+	std::atomic<size_t> Sleepers;
+	std::mutex IdleMutex;
+	std::condition_variable WorkAvailable;
+	/// Number of root jobs which are not finished.
+	std::atomic<size_t> PendingRoots;
+	/// Set when all root jobs are finished.
+	bool Done;
+	std::condition_variable DoneSignal;
+
+	/// Concurrent source accesses, limited to the number of readers.
+	StageSlots ReadSlots;
+	/// Concurrent destination accesses, limited to the number of writers.
+	StageSlots WriteSlots;
+
+	/// Whether directory contents are copied.
+	bool Recursive;
+	/// Number of jobs which are not finished, for the progress output.
+	std::atomic<size_t> LiveJobs;
+
+	std::mutex SummaryMutex;
+	Summary Result;
+
+	StealingContext(size_t readSlots, size_t writeSlots, bool recursive) :
+			QueuedTasks(0), Sleepers(0), PendingRoots(0), Done(false), ReadSlots(
+					readSlots), WriteSlots(writeSlots), Recursive(recursive), LiveJobs(
+					0) {
+	}
+
+	/**
+	 * Adds a task to the deque of the given thread and wakes an idle thread.
+	 */
+	void Push(size_t deque, Task *task);
+};
+
+/**
+ * Thread which executes tasks from its own deque and steals from the deques
+ * of the other threads when it runs out of work. Executes the reading and the
+ * writing side of a task and creates the successor tasks itself.
+ */
+struct ModStealer: ThreadedModule {
+	StealingContext *Context;
+	/// Index of the own deque in the context.
+	size_t Index;
+protected:
+	virtual void run() override;
+	virtual void onStop() override;
+private:
+	/// Returns a task of the own deque or steals one. nullptr if there is none.
+	Task* nextTask();
+	/// Marks the task as finished and pushes the tasks that became possible.
+	void complete(Task *task);
+	/// Ends the chunk sequence or a verification of a file in verify mode.
+	void releaseVerify(Job *job);
+	/// Accounts and deletes a job and notifies its parent.
+	void finishJob(Job *job, bool unchanged);
+};
+
+#endif /* SRC_MODSTEALER_H_ */
@@ -0,0 +1,135 @@
+#include "ModVerifier.h"
+
+#include "Job.h"
+#include "Task.h"
+#include "ThreadsafeBuffer.h"
+#include "IoBackend.h"
+#include "ChunkHash.h"
+#include "HashLog.h"
+#include "CheckpointJournal.h"
+#include "CopyTree.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+extern size_t chunkSize;
+extern VerifyMode verifyMode;
+
+/// O_DIRECT needs buffers, offsets and lengths aligned to the block size.
+static const size_t directAlignment = 4096;
+
+/// Aligned read buffer of the calling thread, grown on demand.
+static char* readBuffer(size_t size) {
+	static thread_local unique_ptr<char, decltype(&free)> buffer(nullptr,
+			&free);
+	static thread_local size_t capacity = 0;
+	if (capacity < size) {
+		void *memory = nullptr;
+		if (posix_memalign(&memory, directAlignment, size) != 0)
+			return nullptr;
+		buffer.reset((char*) memory);
+		capacity = size;
+	}
+	return buffer.get();
+}
+
+bool ModVerifier::Needed(const Task &task) {
+	return verifyMode != VerifyMode::OFF
+			&& task.Type == Task::TaskType::CHUNK
+			&& !task.ItsJob->Log.ErrorReadChunk[task.ChunkIdx];
+}
+
+void ModVerifier::Execute(Task *task) {
+	if (task->Type != Task::TaskType::VERIFY)
+		return;
+	Job *job = task->ItsJob;
+	off_t startPos = task->ChunkIdx * chunkSize;
+	size_t currentChunkSize = min((off_t) chunkSize,
+			job->SourceStat.st_size - startPos);
+	size_t alignedSize = (currentChunkSize + directAlignment - 1)
+			/ directAlignment * directAlignment;
+
+	// All chunks of a file are read through one descriptor
+	int fd;
+	bool direct;
+	{
+		lock_guard<mutex> lock(job->VerifyFdMutex);
+		if (job->VerifyFd < 0) {
+			// Bypass the page cache, which would only return what was just
+			// written
+			if (verifyMode == VerifyMode::DIRECT
+					&& job->VerifyDirectFailedFd < 0)
+				job->VerifyFd = destBackend->Open(job->DestParent.get(),
+						job->DestName(), O_RDONLY | O_NOFOLLOW | O_DIRECT);
+			job->VerifyDirect = job->VerifyFd >= 0;
+			if (!job->VerifyDirect)
+				job->VerifyFd = destBackend->Open(job->DestParent.get(),
+						job->DestName(), O_RDONLY | O_NOFOLLOW);
+		}
+		fd = job->VerifyFd;
+		direct = job->VerifyDirect;
+	}
+
+	char *buffer = readBuffer(alignedSize);
+	ssize_t bytesRead = -1;
+	if (fd >= 0 && buffer != nullptr) {
+		bytesRead = destBackend->Pread(fd, buffer, alignedSize, startPos);
+		// Some filesystems accept O_DIRECT on open but not on read
+		if (bytesRead < 0 && direct) {
+			{
+				lock_guard<mutex> lock(job->VerifyFdMutex);
+				if (job->VerifyDirect) {
+					job->VerifyDirectFailedFd = job->VerifyFd;
+					job->VerifyFd = destBackend->Open(job->DestParent.get(),
+							job->DestName(), O_RDONLY | O_NOFOLLOW);
+					job->VerifyDirect = false;
+				}
+				fd = job->VerifyFd;
+			}
+			if (fd >= 0)
+				bytesRead = destBackend->Pread(fd, buffer, alignedSize,
+						startPos);
+		}
+	}
+
+	task->Mismatch = bytesRead < (ssize_t) currentChunkSize
+			|| hashChunk(buffer, currentChunkSize)
+					!= job->ChunkHashes[task->ChunkIdx];
+	if (!task->Mismatch) {
+		if (journal != nullptr)
+			journal->ChunkDone(*job, task->ChunkIdx);
+		if (hashLog != nullptr)
+			hashLog->ChunkHashed(*job, task->ChunkIdx, currentChunkSize,
+					job->ChunkHashes[task->ChunkIdx]);
+	}
+}
+
+void ModVerifier::CloseFiles(Job *job) {
+	lock_guard<mutex> lock(job->VerifyFdMutex);
+	if (job->VerifyFd >= 0)
+		destBackend->Close(job->VerifyFd);
+	if (job->VerifyDirectFailedFd >= 0)
+		destBackend->Close(job->VerifyDirectFailedFd);
+	job->VerifyFd = job->VerifyDirectFailedFd = -1;
+	job->VerifyDirect = false;
+}
+
+void ModVerifier::run() {
+	// Read elements from the input and put them to the output
+	while (!stop) {
+		Task *task = In->PopFront();
+		if (task == nullptr)
+			continue;
+
+		Execute(task);
+
+		Out->PushBack(task);
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef SRC_MODVERIFIER_H_
+#define SRC_MODVERIFIER_H_
+
+#include "ThreadedModule.h"
+
+template<typename Type>
+class ThreadsafeBuffer;
+struct Task;
+struct Job;
+
+struct ModVerifier: public ThreadedModule {
+	ThreadsafeBuffer<Task> *In;
+	ThreadsafeBuffer<Task> *Out;
+
+	/// Number of times a chunk is rewritten before it counts as an error.
+	static constexpr unsigned MaxRetries = 3;
+
+	ModVerifier() :
+			In(nullptr), Out(nullptr) {
+	}
+
+	/**
+	 * True if the chunk written by a CHUNK task has to be verified: verify
+	 * mode is on and the chunk could be read from the source.
+	 */
+	static bool Needed(const Task &task);
+
+	/**
+	 * Reads the chunk of a VERIFY task back from the destination and compares
+	 * its hash with the one of the source data. Sets Task::Mismatch if they
+	 * differ. Can be called from any thread.
+	 */
+	static void Execute(Task *task);
+
+	/**
+	 * Closes the descriptors the verifications of a job read through. Must be
+	 * called after all of them are finished.
+	 */
+	static void CloseFiles(Job *job);
+protected:
+	virtual void run() override;
+};
+
+#endif /* SRC_MODVERIFIER_H_ */
@@ -1,17 +1,27 @@
 #include "ModWriter.h"
 
+#include "ModVerifier.h"
 #include "Job.h"
 #include "Task.h"
 #include "ThreadsafeBuffer.h"
+#include "IoBackend.h"
+#include "CheckpointJournal.h"
+#include "HashLog.h"
+#include "CopyTree.h"
 
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <string>
+#include <vector>
 
 using namespace std;
 
 extern size_t chunkSize;
+extern VerifyMode verifyMode;
 
 inline bool operator==(const timespec &t1, const timespec &t2) {
 	if (t1.tv_sec != t2.tv_sec)
@@ -25,160 +35,242 @@ inline bool operator!=(const timespec &t1, const timespec &t2) {
 	return !(t1 == t2);
 }
 
-void ModWriter::run() {
-	// Read elements from the input and put them to the output
-	while (!stop) {
-		Task *task = In->PopFront();
-		if (task == nullptr)
-			continue;
+/**
+ * Copies timestamps, owner and mode of the source to the destination, as far
+ * as they differ from DestStat. Uses the descriptor if one is open (fd >= 0)
+ * and the name in the parent directory otherwise.
+ */
+static void preserveAttributes(Job *job, int fd) {
+	// Preserve timestamps
+	if (job->SourceStat.st_mtim.tv_sec != job->DestStat.st_mtim.tv_sec) {
+		struct timespec times[2];
+		times[0] = job->SourceStat.st_atim;
+		times[1] = job->SourceStat.st_mtim;
+		job->Log.ErrorSetTimes = (
+				fd >= 0 ?
+						destBackend->Futimens(fd, times) :
+						destBackend->SetTimes(job->DestParent.get(),
+								job->DestName(), times)) != 0;
+	}
 
-		if (task->Type == Task::TaskType::INIT) {
-			// Get stat of what is already there
-			lstat(task->ItsJob->DestPath.c_str(), &task->ItsJob->DestStat);
-			if (S_ISREG(task->ItsJob->SourceStat.st_mode)) {
-				// Check if wrong output has to be deleted
-				if (task->ItsJob->DestStat.st_ino
-						!= 0&& !S_ISREG(task->ItsJob->DestStat.st_mode)) {
-					std::error_code ec;
-					filesystem::remove_all(task->ItsJob->DestPath, ec);
-					if (ec.value() != 0)
-						task->ItsJob->Log.ErrorDeleteOld = true;
-					// Update stat
-					lstat(task->ItsJob->DestPath.c_str(),
-							&task->ItsJob->DestStat);
-				}
-				// Check if output has to be updated
-				if (task->ItsJob->DestStat.st_ino == 0
-						|| task->ItsJob->DestStat.st_size
-								!= task->ItsJob->SourceStat.st_size
-						|| task->ItsJob->DestStat.st_mtim.tv_sec
-								!= task->ItsJob->SourceStat.st_mtim.tv_sec) {
-					int fd = open(task->ItsJob->DestPath.c_str(),
-					O_WRONLY | O_CREAT | O_TRUNC,
-							task->ItsJob->SourceStat.st_mode);
-					// Don't init sparse file: Quobyte is bad on this!
-					close(fd);
-				}
-			} else if (S_ISDIR(task->ItsJob->SourceStat.st_mode)) {
-				// Check if wrong output has to be deleted
-				if (task->ItsJob->DestStat.st_ino
-						!= 0&& !S_ISDIR(task->ItsJob->DestStat.st_mode)) {
-					std::error_code ec;
-					filesystem::remove_all(task->ItsJob->DestPath, ec);
-					if (ec.value() != 0)
-						task->ItsJob->Log.ErrorDeleteOld = true;
-					// Update stat
-					lstat(task->ItsJob->DestPath.c_str(),
-							&task->ItsJob->DestStat);
+	// Preserve owner
+	if (job->SourceStat.st_uid != job->DestStat.st_uid
+			|| job->SourceStat.st_gid != job->DestStat.st_gid) {
+		job->Log.ErrorSetOwner = (
+				fd >= 0 ?
+						destBackend->Fchown(fd, job->SourceStat.st_uid,
+								job->SourceStat.st_gid) :
+						destBackend->Chown(job->DestParent.get(),
+								job->DestName(), job->SourceStat.st_uid,
+								job->SourceStat.st_gid)) != 0;
+	}
+
+	// Preserve mode
+	if (!S_ISLNK(job->SourceStat.st_mode)
+			&& job->SourceStat.st_mode != job->DestStat.st_mode) {
+		job->Log.ErrorSetMode = (
+				fd >= 0 ?
+						destBackend->Fchmod(fd, job->SourceStat.st_mode) :
+						destBackend->Chmod(job->DestParent.get(),
+								job->DestName(), job->SourceStat.st_mode))
+				!= 0;
+	}
+}
+
+/// Sets the attributes of a file whose content is complete through its descriptor.
+static void finishFile(Job *job, int fd) {
+	if (destBackend->Fstat(fd, &job->DestStat) == 0) {
+		preserveAttributes(job, fd);
+		job->AttribApplied = true;
+	}
+}
+
+/// Removes the destination. DestStat is updated accordingly.
+static void deleteOld(Job *job) {
+	if (!destBackend->RemoveAll(job->DestParent.get(), job->DestName())) {
+		job->Log.ErrorDeleteOld = true;
+		// Update stat
+		destBackend->Stat(job->DestParent.get(), job->DestName(),
+				&job->DestStat);
+	} else
+		memset(&job->DestStat, 0, sizeof(job->DestStat));
+}
+
+void ModWriter::Execute(Task *task) {
+	Job *job = task->ItsJob;
+	if (task->Type == Task::TaskType::INIT) {
+		// Get stat of what is already there
+		destBackend->Stat(job->DestParent.get(), job->DestName(),
+				&job->DestStat);
+		if (S_ISREG(job->SourceStat.st_mode)) {
+			// Check if wrong output has to be deleted
+			if (job->DestStat.st_ino != 0 && !S_ISREG(job->DestStat.st_mode))
+				deleteOld(job);
+			// Check if output has to be updated
+			if (job->DestStat.st_ino == 0
+					|| job->DestStat.st_size != job->SourceStat.st_size
+					|| job->DestStat.st_mtim.tv_sec
+							!= job->SourceStat.st_mtim.tv_sec) {
+				// Continue behind the chunks an interrupted run has written
+				size_t resumeChunks = 0;
+				if (journal != nullptr && job->DestStat.st_ino != 0) {
+					// Only chunks which are still completely in the file count
+					size_t chunksPresent =
+							job->DestStat.st_size >= job->SourceStat.st_size ?
+									job->ChunkState.size() :
+									job->DestStat.st_size / chunkSize;
+					resumeChunks = min(
+							journal->CompletedChunks(*job, chunkSize),
+							chunksPresent);
 				}
-				if (task->ItsJob->DestStat.st_ino == 0) {
-					task->ItsJob->Log.ErrorCreateDest = mkdir(
-							task->ItsJob->DestPath.c_str(),
-							task->ItsJob->SourceStat.st_mode) != 0;
+				off_t resumeSize = min((off_t) (resumeChunks * chunkSize),
+						job->SourceStat.st_size);
+				int fd = -1;
+				if (resumeChunks > 0) {
+					fd = destBackend->Open(job->DestParent.get(),
+							job->DestName(), O_WRONLY);
+					if (fd < 0 || destBackend->Truncate(fd, resumeSize) != 0)
+						resumeChunks = 0;
 				}
-			} else if (S_ISLNK(task->ItsJob->SourceStat.st_mode)) {
-				// Check if wrong output has to be deleted
-				if (task->ItsJob->DestStat.st_ino != 0
-						&& (!S_ISLNK(task->ItsJob->DestStat.st_mode)
-								|| task->ItsJob->SourceStat.st_size
-										!= task->ItsJob->DestStat.st_size
-								|| task->ItsJob->SourceStat.st_mtim.tv_sec
-										!= task->ItsJob->DestStat.st_mtim.tv_sec)) {
-					std::error_code ec;
-					filesystem::remove_all(task->ItsJob->DestPath, ec);
-					if (ec.value() != 0)
-						task->ItsJob->Log.ErrorDeleteOld = true;
-					// Update stat
-					lstat(task->ItsJob->DestPath.c_str(),
-							&task->ItsJob->DestStat);
+
+				if (resumeChunks > 0) {
+					for (size_t c = 0; c < resumeChunks; c++)
+						job->ChunkState[c] = Job::CopyState::DONE;
+					job->Log.ResumedChunks = resumeChunks;
+				} else {
+					if (fd >= 0)
+						destBackend->Close(fd);
+					fd = destBackend->Open(job->DestParent.get(),
+							job->DestName(), O_WRONLY | O_CREAT | O_TRUNC,
+							job->SourceStat.st_mode);
+					// Don't init sparse file: Quobyte is bad on this!
 				}
+				// Without chunks left to write, the file is complete already
+				if (fd >= 0 && resumeChunks == job->ChunkState.size())
+					finishFile(job, fd);
+				if (fd >= 0)
+					destBackend->Close(fd);
+			}
+		} else if (S_ISDIR(job->SourceStat.st_mode)) {
+			// Check if wrong output has to be deleted
+			if (job->DestStat.st_ino != 0 && !S_ISDIR(job->DestStat.st_mode))
+				deleteOld(job);
+			// The owner needs full access until the attributes set the
+			// mode, or a read-only source directory could not be filled
+			if (job->DestStat.st_ino == 0) {
+				job->Log.ErrorCreateDest = destBackend->Mkdir(
+						job->DestParent.get(), job->DestName(),
+						(job->SourceStat.st_mode & 07777) | S_IRWXU) != 0;
+			} else if ((job->DestStat.st_mode & S_IRWXU) != S_IRWXU) {
+				destBackend->Chmod(job->DestParent.get(), job->DestName(),
+						(job->DestStat.st_mode & 07777) | S_IRWXU);
+			}
+			// Keep it open for its contents
+			job->DestDir = destBackend->OpenDirectory(job->DestParent.get(),
+					job->DestName());
+		} else if (S_ISLNK(job->SourceStat.st_mode)) {
+			// Check if wrong output has to be deleted
+			if (job->DestStat.st_ino != 0
+					&& (!S_ISLNK(job->DestStat.st_mode)
+							|| job->SourceStat.st_size != job->DestStat.st_size
+							|| job->SourceStat.st_mtim.tv_sec
+									!= job->DestStat.st_mtim.tv_sec))
+				deleteOld(job);
 
-				// Check if link has to be created
-				if (task->ItsJob->DestStat.st_ino == 0
-						|| task->ItsJob->DestStat.st_size
-								!= task->ItsJob->SourceStat.st_size
-						|| task->ItsJob->DestStat.st_mtim.tv_sec
-								!= task->ItsJob->SourceStat.st_mtim.tv_sec) {
-					if (task->data.size() > 0) {
-						task->ItsJob->Log.ErrorCreateDest = symlinkat(
-								&task->data[0], AT_FDCWD,
-								task->ItsJob->DestPath.c_str()) != 0;
-					}
+			// Check if link has to be created
+			if (job->DestStat.st_ino == 0
+					|| job->DestStat.st_size != job->SourceStat.st_size
+					|| job->DestStat.st_mtim.tv_sec
+							!= job->SourceStat.st_mtim.tv_sec) {
+				if (task->data.size() > 0) {
+					job->Log.ErrorCreateDest = destBackend->Symlink(
+							&task->data[0], job->DestParent.get(),
+							job->DestName()) != 0;
 				}
 			}
-		} else if (task->Type == Task::TaskType::CHUNK) {
-			if (!task->data.empty()) {
-				size_t startPos = task->ChunkIdx * chunkSize;
-				size_t currentChunkSize = task->data.size();
-				int fd = open(task->ItsJob->DestPath.c_str(),
-				O_WRONLY | O_APPEND);
-				task->ItsJob->Log.ErrorWriteChunk[task->ChunkIdx] = write(fd,
-						&task->data[0], currentChunkSize) == 0;
-				close(fd);
+		}
+	} else if (task->Type == Task::TaskType::CHUNK) {
+		if (!task->data.empty()) {
+			size_t currentChunkSize = task->data.size();
+			// A chunk that failed verification is rewritten in place, all
+			// others are appended
+			bool rewrite = job->ChunkMismatches[task->ChunkIdx] > 0;
+			int fd = destBackend->Open(job->DestParent.get(), job->DestName(),
+					rewrite ? O_WRONLY : O_WRONLY | O_APPEND);
+			ssize_t written =
+					fd < 0 ? -1 :
+					rewrite ?
+							destBackend->Pwrite(fd, &task->data[0],
+									currentChunkSize,
+									task->ChunkIdx * chunkSize) :
+							destBackend->Write(fd, &task->data[0],
+									currentChunkSize);
+			job->Log.ErrorWriteChunk[task->ChunkIdx] = written <= 0;
+			// Chunks to be verified are recorded by the verifier, and a
+			// rewrite may still change the file after the last chunk
+			if (written == (ssize_t) currentChunkSize
+					&& verifyMode == VerifyMode::OFF) {
+				if (journal != nullptr)
+					journal->ChunkDone(*job, task->ChunkIdx);
+				if (hashLog != nullptr)
+					hashLog->ChunkHashed(*job, task->ChunkIdx,
+							currentChunkSize, job->ChunkHashes[task->ChunkIdx]);
+				// Set the attributes while the file is open anyway
+				if (task->ChunkIdx + 1 == job->ChunkState.size())
+					finishFile(job, fd);
 			}
-		} else if (task->Type == Task::TaskType::ATTRIBUTES) {
-			// Check if there is a valid input stat
-			if (task->ItsJob->SourceStat.st_ino != 0) {
-				// Check if there is an output object
-				lstat(task->ItsJob->DestPath.c_str(), &task->ItsJob->DestStat);
-				if (task->ItsJob->DestStat.st_ino != 0) {
-					// If directory, delete content which is not in the input
-					if (S_ISDIR(task->ItsJob->DestStat.st_mode)) {
-						for (const auto &entry : filesystem::directory_iterator(
-								task->ItsJob->DestPath)) {
-							struct stat sin;
-							bool inputExists = lstat(
-									(task->ItsJob->SourcePath
-											/ entry.path().filename()).c_str(),
-									&sin) == 0;
-							if (!inputExists) {
-								std::error_code ec;
-								filesystem::remove_all(
-										task->ItsJob->DestPath
-												/ entry.path().filename(), ec);
-								task->ItsJob->Log.ErrorDeleteDirContents |=
-										ec.value() != 0;
-							}
+			if (fd >= 0)
+				destBackend->Close(fd);
+		}
+	} else if (task->Type == Task::TaskType::ATTRIBUTES) {
+		// All verifications are finished
+		ModVerifier::CloseFiles(job);
+		// Check if there is a valid input stat and if the attributes are
+		// still missing
+		if (job->SourceStat.st_ino != 0 && !job->AttribApplied) {
+			// If directory, delete content which is not in the input
+			if (S_ISDIR(job->SourceStat.st_mode) && job->DestDir
+					&& !job->Log.ErrorCreateDest) {
+				vector<string> sourceNames, destNames;
+				bool listed = sourceBackend->ListDirectory(*job->SourceDir,
+						sourceNames);
+				listed &= destBackend->ListDirectory(*job->DestDir, destNames);
+				job->Log.ErrorDeleteDirContents |= !listed;
+				if (listed) {
+					sort(sourceNames.begin(), sourceNames.end());
+					for (const string &name : destNames) {
+						if (!binary_search(sourceNames.begin(),
+								sourceNames.end(), name)) {
+							job->Log.ErrorDeleteDirContents |=
+									!destBackend->RemoveAll(job->DestDir.get(),
+											name);
 						}
 					}
-
-					// fetch stats again which could have changed due to deleting content
-					lstat(task->ItsJob->DestPath.c_str(),
-							&task->ItsJob->DestStat);
-
-					// Preserve timestamps
-					if (task->ItsJob->SourceStat.st_mtim.tv_sec
-							!= task->ItsJob->DestStat.st_mtim.tv_sec) {
-						struct timespec times[2];
-						times[0] = task->ItsJob->SourceStat.st_atim;
-						times[1] = task->ItsJob->SourceStat.st_mtim;
-						task->ItsJob->Log.ErrorSetTimes = utimensat(AT_FDCWD,
-								task->ItsJob->DestPath.c_str(), times,
-								AT_SYMLINK_NOFOLLOW) != 0;
-					}
-
-					// Preserve owner
-					if (task->ItsJob->SourceStat.st_uid
-							!= task->ItsJob->DestStat.st_uid
-							|| task->ItsJob->SourceStat.st_gid
-									!= task->ItsJob->DestStat.st_gid) {
-						task->ItsJob->Log.ErrorSetOwner = lchown(
-								task->ItsJob->DestPath.c_str(),
-								task->ItsJob->SourceStat.st_uid,
-								task->ItsJob->SourceStat.st_gid) != 0;
-					}
-
-					// Preserve mode
-					if (!S_ISLNK(task->ItsJob->SourceStat.st_mode)
-							&& task->ItsJob->SourceStat.st_mode
-									!= task->ItsJob->DestStat.st_mode) {
-						task->ItsJob->Log.ErrorSetMode = chmod(
-								task->ItsJob->DestPath.c_str(),
-								task->ItsJob->SourceStat.st_mode) != 0;
-					}
 				}
 			}
+
+			// Fetch stats once, after deleting content changed them
+			int fd = job->DestDir ? job->DestDir->Fd : -1;
+			bool destExists =
+					fd >= 0 ?
+							destBackend->Fstat(fd, &job->DestStat) == 0 :
+							destBackend->Stat(job->DestParent.get(),
+									job->DestName(), &job->DestStat) == 0;
+			if (destExists)
+				preserveAttributes(job, fd);
 		}
+	}
+}
+
+void ModWriter::run() {
+	// Read elements from the input and put them to the output
+	while (!stop) {
+		Task *task = In->PopFront();
+		if (task == nullptr)
+			continue;
+
+		Execute(task);
+		task->WriterNode = Node();
 
 		Out->PushBack(task);
 	}
@@ -10,6 +10,12 @@ struct Task;
 struct ModWriter : public ThreadedModule {
 	ThreadsafeBuffer<Task>* In;
 	ThreadsafeBuffer<Task>* Out;
+
+	/**
+	 * Writes the destination side of a task: creates the destination, writes
+	 * chunk data and sets attributes. Can be called from any thread.
+	 */
+	static void Execute(Task *task);
 protected:
 	virtual void run() override;
 };
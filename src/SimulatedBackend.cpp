@@ -0,0 +1,272 @@
+#include "SimulatedBackend.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+SimulatedBackend::Config::Config() :
+		MetaLatencyUs(500), MetadataServers(1), DataLatencyUs(200), ClientBandwidth(
+				1000ull * 1024 * 1024), StripeSize(1024 * 1024), StorageServers(
+				8), ServerBandwidth(200ull * 1024 * 1024) {
+}
+
+bool SimulatedBackend::Config::Parse(const string &spec) {
+	stringstream stream(spec);
+	string item;
+	while (getline(stream, item, ',')) {
+		size_t equals = item.find('=');
+		if (equals == string::npos)
+			return false;
+		string key = item.substr(0, equals);
+		uint64_t value = strtoull(item.c_str() + equals + 1, nullptr, 10);
+		if (key == "meta_us")
+			MetaLatencyUs = value;
+		else if (key == "mds")
+			MetadataServers = max((uint64_t) 1, value);
+		else if (key == "data_us")
+			DataLatencyUs = value;
+		else if (key == "client_mbps")
+			ClientBandwidth = value * 1024 * 1024;
+		else if (key == "stripe_kb")
+			StripeSize = max((uint64_t) 1, value) * 1024;
+		else if (key == "servers")
+			StorageServers = max((uint64_t) 1, value);
+		else if (key == "server_mbps")
+			ServerBandwidth = value * 1024 * 1024;
+		else
+			return false;
+	}
+	return true;
+}
+
+SimulatedBackend::SimulatedBackend(IoBackend *underlying, const Config &config) :
+		underlying(underlying), config(config), metadataFree(
+				config.MetadataServers), serverFree(config.StorageServers) {
+}
+
+/// Time needed to move count bytes with the given bandwidth.
+static chrono::nanoseconds transferTime(uint64_t count, uint64_t bandwidth) {
+	if (bandwidth == 0)
+		return chrono::nanoseconds(0);
+	return chrono::nanoseconds((uint64_t) (count * 1e9 / bandwidth));
+}
+
+void SimulatedBackend::metadataOperation(const filesystem::path &directory) {
+	// Metadata is sharded by parent directory
+	size_t server = hash<string>()(directory.string())
+			% config.MetadataServers;
+
+	Clock::time_point done;
+	{
+		lock_guard<mutex> lock(timelineModified);
+		Clock::time_point start = max(Clock::now(), metadataFree[server]);
+		done = start + chrono::microseconds(config.MetaLatencyUs);
+		metadataFree[server] = done;
+	}
+	this_thread::sleep_until(done);
+}
+
+void SimulatedBackend::metadataOperation(int fd) {
+	filesystem::path directory;
+	{
+		lock_guard<mutex> lock(descriptorsModified);
+		auto entry = descriptors.find(fd);
+		if (entry != descriptors.end())
+			directory = entry->second.Directory;
+	}
+	metadataOperation(directory);
+}
+
+void SimulatedBackend::dataOperation(uint64_t offset, uint64_t count) {
+	Clock::time_point done;
+	{
+		lock_guard<mutex> lock(timelineModified);
+		Clock::time_point start = Clock::now()
+				+ chrono::microseconds(config.DataLatencyUs);
+
+		Clock::time_point clientStart = max(start, clientFree);
+		clientFree = clientStart
+				+ transferTime(count, config.ClientBandwidth);
+		done = clientFree;
+
+		// Every stripe of the range is served by its own storage server
+		uint64_t position = offset;
+		while (position < offset + count) {
+			uint64_t stripe = position / config.StripeSize;
+			uint64_t piece = min((stripe + 1) * config.StripeSize,
+					offset + count) - position;
+			Clock::time_point &server = serverFree[stripe
+					% config.StorageServers];
+			server = max(start, server)
+					+ transferTime(piece, config.ServerBandwidth);
+			done = max(done, server);
+			position += piece;
+		}
+	}
+	this_thread::sleep_until(done);
+}
+
+int SimulatedBackend::Stat(const DirHandle *dir, const string &name,
+		struct stat *buf, unsigned int mask) {
+	metadataOperation(entryPath(dir, name).parent_path());
+	return underlying->Stat(dir, name, buf, mask);
+}
+
+int SimulatedBackend::Fstat(int fd, struct stat *buf, unsigned int mask) {
+	metadataOperation(fd);
+	return underlying->Fstat(fd, buf, mask);
+}
+
+int SimulatedBackend::Open(const DirHandle *dir, const string &name, int flags,
+		mode_t mode) {
+	filesystem::path directory = entryPath(dir, name).parent_path();
+	metadataOperation(directory);
+	int fd = underlying->Open(dir, name, flags, mode);
+	if (fd < 0)
+		return fd;
+
+	// Appends start at the size, which the open reply of the metadata server
+	// carries along
+	OpenFile file { directory, 0, (flags & O_APPEND) != 0 };
+	if ((flags & O_APPEND) && !(flags & O_TRUNC)) {
+		struct stat fileStat;
+		if (underlying->Fstat(fd, &fileStat, STATX_SIZE) != 0) {
+			int error = errno;
+			underlying->Close(fd);
+			errno = error;
+			return -1;
+		}
+		file.Position = fileStat.st_size;
+	}
+	lock_guard<mutex> lock(descriptorsModified);
+	descriptors[fd] = file;
+	return fd;
+}
+
+int SimulatedBackend::Close(int fd) {
+	{
+		lock_guard<mutex> lock(descriptorsModified);
+		descriptors.erase(fd);
+	}
+	return underlying->Close(fd);
+}
+
+ssize_t SimulatedBackend::Pread(int fd, void *buf, size_t count, off_t offset) {
+	ssize_t result = underlying->Pread(fd, buf, count, offset);
+	if (result > 0)
+		dataOperation(offset, result);
+	return result;
+}
+
+ssize_t SimulatedBackend::Write(int fd, const void *buf, size_t count) {
+	// The stripes are determined by the position the simulation tracks
+	off_t offset = 0;
+	{
+		lock_guard<mutex> lock(descriptorsModified);
+		auto entry = descriptors.find(fd);
+		if (entry != descriptors.end())
+			offset = entry->second.Position;
+	}
+	ssize_t result = underlying->Write(fd, buf, count);
+	if (result > 0) {
+		{
+			lock_guard<mutex> lock(descriptorsModified);
+			auto entry = descriptors.find(fd);
+			if (entry != descriptors.end())
+				entry->second.Position = offset + result;
+		}
+		dataOperation(offset, result);
+	}
+	return result;
+}
+
+ssize_t SimulatedBackend::Pwrite(int fd, const void *buf, size_t count,
+		off_t offset) {
+	ssize_t result = underlying->Pwrite(fd, buf, count, offset);
+	if (result > 0)
+		dataOperation(offset, result);
+	return result;
+}
+
+int SimulatedBackend::Truncate(int fd, off_t length) {
+	// Changes the size in the metadata of the file
+	metadataOperation(fd);
+	int result = underlying->Truncate(fd, length);
+	if (result == 0) {
+		lock_guard<mutex> lock(descriptorsModified);
+		auto entry = descriptors.find(fd);
+		if (entry != descriptors.end() && entry->second.Append)
+			entry->second.Position = length;
+	}
+	return result;
+}
+
+ssize_t SimulatedBackend::ReadLink(const DirHandle *dir, const string &name,
+		char *buf, size_t size) {
+	metadataOperation(entryPath(dir, name).parent_path());
+	return underlying->ReadLink(dir, name, buf, size);
+}
+
+int SimulatedBackend::Symlink(const char *target, const DirHandle *dir,
+		const string &name) {
+	metadataOperation(entryPath(dir, name).parent_path());
+	return underlying->Symlink(target, dir, name);
+}
+
+int SimulatedBackend::Mkdir(const DirHandle *dir, const string &name,
+		mode_t mode) {
+	metadataOperation(entryPath(dir, name).parent_path());
+	return underlying->Mkdir(dir, name, mode);
+}
+
+int SimulatedBackend::SetTimes(const DirHandle *dir, const string &name,
+		const struct timespec times[2]) {
+	metadataOperation(entryPath(dir, name).parent_path());
+	return underlying->SetTimes(dir, name, times);
+}
+
+int SimulatedBackend::Chown(const DirHandle *dir, const string &name,
+		uid_t uid, gid_t gid) {
+	metadataOperation(entryPath(dir, name).parent_path());
+	return underlying->Chown(dir, name, uid, gid);
+}
+
+int SimulatedBackend::Chmod(const DirHandle *dir, const string &name,
+		mode_t mode) {
+	metadataOperation(entryPath(dir, name).parent_path());
+	return underlying->Chmod(dir, name, mode);
+}
+
+int SimulatedBackend::Futimens(int fd, const struct timespec times[2]) {
+	metadataOperation(fd);
+	return underlying->Futimens(fd, times);
+}
+
+int SimulatedBackend::Fchown(int fd, uid_t uid, gid_t gid) {
+	metadataOperation(fd);
+	return underlying->Fchown(fd, uid, gid);
+}
+
+int SimulatedBackend::Fchmod(int fd, mode_t mode) {
+	metadataOperation(fd);
+	return underlying->Fchmod(fd, mode);
+}
+
+bool SimulatedBackend::RemoveAll(const DirHandle *dir, const string &name) {
+	metadataOperation(entryPath(dir, name).parent_path());
+	return underlying->RemoveAll(dir, name);
+}
+
+bool SimulatedBackend::ListDirectory(const DirHandle &dir,
+		vector<string> &names) {
+	// The entries are stored on the server responsible for the directory
+	metadataOperation(dir.Path);
+	return underlying->ListDirectory(dir, names);
+}
@@ -0,0 +1,119 @@
+#ifndef SRC_SIMULATEDBACKEND_H_
+#define SRC_SIMULATEDBACKEND_H_
+
+#include "IoBackend.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Backend that behaves like a parallel filesystem seen from one client. All
+ * operations are executed on an underlying backend (e.g. local files) and
+ * then delayed according to a simple model:
+ * - every metadata operation waits for one of the metadata servers, which
+ *   serve one request after another with a fixed latency,
+ * - every data operation has a fixed latency plus the time to move its bytes
+ *   through the client's link and through the storage servers its range is
+ *   striped over.
+ */
+class SimulatedBackend: public IoBackend {
+public:
+	struct Config {
+		/// Service time of a metadata operation in microseconds.
+		uint64_t MetaLatencyUs;
+		/// Number of metadata servers. Operations on the same server are serialized.
+		size_t MetadataServers;
+		/// Latency of a read or write request in microseconds.
+		uint64_t DataLatencyUs;
+		/// Bandwidth of the client link in bytes/s, 0 for unlimited.
+		uint64_t ClientBandwidth;
+		/// Size of a stripe in bytes.
+		uint64_t StripeSize;
+		/// Number of storage servers stripes are distributed over.
+		size_t StorageServers;
+		/// Bandwidth of one storage server in bytes/s, 0 for unlimited.
+		uint64_t ServerBandwidth;
+
+		Config();
+
+		/**
+		 * Reads settings from a comma separated list of key=value pairs with
+		 * the keys meta_us, mds, data_us, client_mbps, stripe_kb, servers
+		 * and server_mbps.
+		 * @returns false if the list contains an unknown key.
+		 */
+		bool Parse(const std::string &spec);
+	};
+
+	SimulatedBackend(IoBackend *underlying, const Config &config);
+
+	int Stat(const DirHandle *dir, const std::string &name, struct stat *buf,
+			unsigned int mask = StatMaskAttributes) override;
+	int Fstat(int fd, struct stat *buf, unsigned int mask = StatMaskAttributes)
+			override;
+	int Open(const DirHandle *dir, const std::string &name, int flags,
+			mode_t mode = 0) override;
+	int Close(int fd) override;
+	ssize_t Pread(int fd, void *buf, size_t count, off_t offset) override;
+	ssize_t Write(int fd, const void *buf, size_t count) override;
+	ssize_t Pwrite(int fd, const void *buf, size_t count, off_t offset)
+			override;
+	int Truncate(int fd, off_t length) override;
+	ssize_t ReadLink(const DirHandle *dir, const std::string &name, char *buf,
+			size_t size) override;
+	int Symlink(const char *target, const DirHandle *dir,
+			const std::string &name) override;
+	int Mkdir(const DirHandle *dir, const std::string &name, mode_t mode)
+			override;
+	int SetTimes(const DirHandle *dir, const std::string &name,
+			const struct timespec times[2]) override;
+	int Chown(const DirHandle *dir, const std::string &name, uid_t uid,
+			gid_t gid) override;
+	int Chmod(const DirHandle *dir, const std::string &name, mode_t mode)
+			override;
+	int Futimens(int fd, const struct timespec times[2]) override;
+	int Fchown(int fd, uid_t uid, gid_t gid) override;
+	int Fchmod(int fd, mode_t mode) override;
+	bool RemoveAll(const DirHandle *dir, const std::string &name) override;
+	bool ListDirectory(const DirHandle &dir, std::vector<std::string> &names)
+			override;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	IoBackend *underlying;
+	Config config;
+
+	/// Point in time when each metadata server is free again.
+	std::vector<Clock::time_point> metadataFree;
+	/// Point in time when the client link is free again.
+	Clock::time_point clientFree;
+	/// Point in time when each storage server is free again.
+	std::vector<Clock::time_point> serverFree;
+	std::mutex timelineModified;
+
+	struct OpenFile {
+		/// Parent directory, which determines the metadata server.
+		std::filesystem::path Directory;
+		/// Offset the next Write() goes to, which determines the stripes.
+		off_t Position;
+		/// Opened with O_APPEND: every write goes to the end of the file.
+		bool Append;
+	};
+	/// Every open descriptor.
+	std::unordered_map<int, OpenFile> descriptors;
+	std::mutex descriptorsModified;
+
+	/// Waits for the metadata server responsible for the directory.
+	void metadataOperation(const std::filesystem::path &directory);
+	/// Waits for the metadata server responsible for an open descriptor.
+	void metadataOperation(int fd);
+	/// Waits until a transfer of the byte range has passed link and servers.
+	void dataOperation(uint64_t offset, uint64_t count);
+};
+
+#endif /* SRC_SIMULATEDBACKEND_H_ */
@@ -0,0 +1,96 @@
+#include "Summary.h"
+
+#include "Job.h"
+#include "Task.h"
+
+#include <algorithm>
+
+using namespace std;
+
+static const char *counterNames[Summary::NUM_COUNTERS] = { "jobs", "files",
+		"directories", "links", "unchanged", "chunks", "resumed_chunks", "bytes",
+		"cross_node_bytes", "verified_chunks", "verify_mismatches",
+		"error_stat_source", "error_source_type", "error_read_link",
+		"error_delete_old", "error_create_dest", "error_read_chunk",
+		"error_write_chunk", "error_verify_chunk", "error_delete_dir_contents",
+		"error_set_times",
+		"error_set_owner", "error_set_mode" };
+
+Summary::Summary() {
+	fill(Counters, Counters + NUM_COUNTERS, 0);
+}
+
+void Summary::Add(const Job &job, bool unchanged) {
+	Counters[JOBS]++;
+	if (S_ISREG(job.SourceStat.st_mode))
+		Counters[FILES]++;
+	else if (S_ISDIR(job.SourceStat.st_mode))
+		Counters[DIRECTORIES]++;
+	else if (S_ISLNK(job.SourceStat.st_mode))
+		Counters[LINKS]++;
+	if (unchanged)
+		Counters[UNCHANGED]++;
+	Counters[RESUMED_CHUNKS] += job.Log.ResumedChunks;
+
+	Counters[ERROR_STAT_SOURCE] += job.Log.ErrorStatSource;
+	Counters[ERROR_SOURCE_TYPE] += job.Log.ErrorSourceType;
+	Counters[ERROR_READ_LINK] += job.Log.ErrorReadLink;
+	Counters[ERROR_DELETE_OLD] += job.Log.ErrorDeleteOld;
+	Counters[ERROR_CREATE_DEST] += job.Log.ErrorCreateDest;
+	Counters[ERROR_READ_CHUNK] += count(job.Log.ErrorReadChunk.begin(),
+			job.Log.ErrorReadChunk.end(), true);
+	Counters[ERROR_WRITE_CHUNK] += count(job.Log.ErrorWriteChunk.begin(),
+			job.Log.ErrorWriteChunk.end(), true);
+	Counters[ERROR_VERIFY_CHUNK] += count(job.Log.ErrorVerifyChunk.begin(),
+			job.Log.ErrorVerifyChunk.end(), true);
+	Counters[ERROR_DELETE_DIR_CONTENTS] += job.Log.ErrorDeleteDirContents;
+	Counters[ERROR_SET_TIMES] += job.Log.ErrorSetTimes;
+	Counters[ERROR_SET_OWNER] += job.Log.ErrorSetOwner;
+	Counters[ERROR_SET_MODE] += job.Log.ErrorSetMode;
+}
+
+void Summary::AddChunk(const Task &task) {
+	Counters[CHUNKS]++;
+	Counters[BYTES] += task.data.size();
+	// Data read on one NUMA node and written on another crossed the interconnect
+	if (task.BufferNode >= 0 && task.WriterNode >= 0
+			&& task.BufferNode != task.WriterNode)
+		Counters[CROSS_NODE_BYTES] += task.data.size();
+}
+
+void Summary::AddVerify(const Task &task) {
+	if (task.Mismatch)
+		Counters[VERIFY_MISMATCHES]++;
+	else
+		Counters[VERIFIED_CHUNKS]++;
+}
+
+uint64_t Summary::Errors() const {
+	uint64_t result = 0;
+	for (size_t c = ERROR_STAT_SOURCE; c < NUM_COUNTERS; c++)
+		result += Counters[c];
+	return result;
+}
+
+Summary& Summary::operator+=(const Summary &other) {
+	for (size_t c = 0; c < NUM_COUNTERS; c++)
+		Counters[c] += other.Counters[c];
+	return *this;
+}
+
+void Summary::Print(ostream &out) const {
+	for (size_t c = 0; c < NUM_COUNTERS; c++)
+		if (c < ERROR_STAT_SOURCE || Counters[c] != 0)
+			out << counterNames[c] << ": " << Counters[c] << endl;
+}
+
+vector<uint64_t> Summary::Serialize() const {
+	return vector<uint64_t>(Counters, Counters + NUM_COUNTERS);
+}
+
+bool Summary::Deserialize(const vector<uint64_t> &data) {
+	if (data.size() != NUM_COUNTERS)
+		return false;
+	copy(data.begin(), data.end(), Counters);
+	return true;
+}
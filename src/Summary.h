@@ -0,0 +1,75 @@
+#ifndef SRC_SUMMARY_H_
+#define SRC_SUMMARY_H_
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+struct Job;
+struct Task;
+
+/**
+ * Aggregated outcome of a sync. Collects the Log of every finished job so
+ * the results of several copy runs (possibly in different processes) can
+ * be summed up and shown to the user.
+ */
+struct Summary {
+	enum Counter {
+		JOBS,
+		FILES,
+		DIRECTORIES,
+		LINKS,
+		UNCHANGED,
+		CHUNKS,
+		RESUMED_CHUNKS,
+		BYTES,
+		CROSS_NODE_BYTES,
+		VERIFIED_CHUNKS,
+		VERIFY_MISMATCHES,
+		ERROR_STAT_SOURCE,
+		ERROR_SOURCE_TYPE,
+		ERROR_READ_LINK,
+		ERROR_DELETE_OLD,
+		ERROR_CREATE_DEST,
+		ERROR_READ_CHUNK,
+		ERROR_WRITE_CHUNK,
+		ERROR_VERIFY_CHUNK,
+		ERROR_DELETE_DIR_CONTENTS,
+		ERROR_SET_TIMES,
+		ERROR_SET_OWNER,
+		ERROR_SET_MODE,
+		NUM_COUNTERS
+	};
+
+	uint64_t Counters[NUM_COUNTERS];
+
+	Summary();
+
+	/**
+	 * Accounts the log of a job which is about to be deleted.
+	 * @param unchanged True if the job was skipped because the destination
+	 * was already up to date.
+	 */
+	void Add(const Job &job, bool unchanged);
+
+	/// Accounts a chunk which was written.
+	void AddChunk(const Task &task);
+
+	/// Accounts a chunk which was verified.
+	void AddVerify(const Task &task);
+
+	/// Number of errors over all error counters.
+	uint64_t Errors() const;
+
+	Summary& operator+=(const Summary &other);
+
+	/// Human readable representation, one counter per line.
+	void Print(std::ostream &out) const;
+
+	/// Flat representation for sending over the coordinator protocol.
+	std::vector<uint64_t> Serialize() const;
+	/// Inverse of Serialize(). Returns false if the data does not fit.
+	bool Deserialize(const std::vector<uint64_t> &data);
+};
+
+#endif /* SRC_SUMMARY_H_ */
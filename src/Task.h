@@ -11,7 +11,7 @@ struct Job;
  */
 struct Task {
 	enum struct TaskType {
-		INIT, CHUNK, ATTRIBUTES
+		INIT, CHUNK, VERIFY, ATTRIBUTES
 	} Type;
 
 	size_t ChunkIdx;
@@ -20,9 +20,18 @@ struct Task {
 
 	Job *ItsJob;
 
+	/// NUMA node the pages of data were placed on, -1 if unknown.
+	int BufferNode;
+	/// NUMA node of the thread that wrote data, -1 if unknown.
+	int WriterNode;
+
+	/// Set by the verifier if the destination does not match the source.
+	bool Mismatch;
+
 public:
 	Task(const TaskType &type, Job *job, const size_t chunkIdx = -1) :
-			Type(type), ItsJob(job), ChunkIdx(chunkIdx) {
+			Type(type), ItsJob(job), ChunkIdx(chunkIdx), BufferNode(-1), WriterNode(
+					-1), Mismatch(false) {
 	}
 };
 
@@ -0,0 +1,128 @@
+#include "ThreadPlacement.h"
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+ThreadPlacement readerPlacement;
+ThreadPlacement writerPlacement;
+ThreadPlacement schedulerPlacement;
+
+static const char *nodeDirectory = "/sys/devices/system/node";
+
+bool parseCpuList(const string &list, vector<int> &result) {
+	stringstream stream(list);
+	string item;
+	while (getline(stream, item, ',')) {
+		if (item.empty() || item == "\n")
+			continue;
+		char *end;
+		long first = strtol(item.c_str(), &end, 10);
+		long last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		if (end == item.c_str() || (*end != 0 && *end != '\n') || first < 0
+				|| last < first)
+			return false;
+		for (long n = first; n <= last; n++)
+			result.push_back(n);
+	}
+	return true;
+}
+
+/// Reads a list file from sysfs. Returns false if it does not exist.
+static bool readList(const string &path, vector<int> &result) {
+	ifstream file(path);
+	string list;
+	if (!getline(file, list))
+		return false;
+	return parseCpuList(list, result);
+}
+
+int cpuNode(int cpu) {
+	vector<int> nodes;
+	if (!readList(string(nodeDirectory) + "/online", nodes))
+		return -1;
+	for (int node : nodes) {
+		vector<int> cpus;
+		readList(string(nodeDirectory) + "/node" + to_string(node) + "/cpulist",
+				cpus);
+		for (int c : cpus)
+			if (c == cpu)
+				return node;
+	}
+	return -1;
+}
+
+bool ThreadPlacement::Parse(const string &spec) {
+	cpus.clear();
+	nodes.clear();
+
+	bool byNode = spec.compare(0, 5, "node:") == 0;
+	if (!byNode && spec.compare(0, 4, "cpu:") != 0)
+		return false;
+	vector<int> entries;
+	if (!parseCpuList(spec.substr(byNode ? 5 : 4), entries) || entries.empty())
+		return false;
+
+	for (int entry : entries) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (byNode) {
+			vector<int> nodeCpus;
+			if (!readList(
+					string(nodeDirectory) + "/node" + to_string(entry)
+							+ "/cpulist", nodeCpus) || nodeCpus.empty())
+				return false;
+			for (int cpu : nodeCpus)
+				CPU_SET(cpu, &set);
+			nodes.push_back(entry);
+		} else {
+			if (entry >= CPU_SETSIZE)
+				return false;
+			CPU_SET(entry, &set);
+			nodes.push_back(cpuNode(entry));
+		}
+		cpus.push_back(set);
+	}
+	return true;
+}
+
+const cpu_set_t* ThreadPlacement::Cpus(size_t thread) const {
+	if (cpus.empty())
+		return nullptr;
+	return &cpus[thread % cpus.size()];
+}
+
+int ThreadPlacement::Node(size_t thread) const {
+	if (nodes.empty())
+		return -1;
+	return nodes[thread % nodes.size()];
+}
+
+void ThreadPlacement::Apply(size_t thread) const {
+	if (!cpus.empty())
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), Cpus(thread));
+}
+
+void preferNode(void *buffer, size_t length, int node) {
+	if (node < 0 || node >= (int) (8 * sizeof(unsigned long)))
+		return;
+	size_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t) buffer + page - 1) / page * page;
+	uintptr_t end = ((uintptr_t) buffer + length) / page * page;
+	if (end <= start)
+		return;
+	unsigned long mask = 1ul << node;
+	// Failing is harmless: the pages just end up where they are touched first
+	syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, &mask,
+			8 * sizeof(mask), 0);
+}
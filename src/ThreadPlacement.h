@@ -0,0 +1,67 @@
+#ifndef SRC_THREADPLACEMENT_H_
+#define SRC_THREADPLACEMENT_H_
+
+#include <sched.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * CPUs a group of threads (e.g. all readers) is bound to. The threads are
+ * distributed round robin over the entries of the placement: either NUMA
+ * nodes, whose threads may run on all CPUs of the node, or single CPUs.
+ */
+class ThreadPlacement {
+	/// Allowed CPUs of each entry.
+	std::vector<cpu_set_t> cpus;
+	/// NUMA node of each entry, -1 if unknown.
+	std::vector<int> nodes;
+
+public:
+	/**
+	 * Reads a placement of the form node:LIST or cpu:LIST where LIST is a
+	 * comma separated list of numbers and ranges like 0-3. The topology is
+	 * taken from /sys/devices/system/node.
+	 * @returns false if the placement is malformed or names an unknown node.
+	 */
+	bool Parse(const std::string &spec);
+
+	/// True if the threads are not bound at all.
+	bool Empty() const {
+		return cpus.empty();
+	}
+
+	/// CPUs of the thread with the given index, nullptr if unbound.
+	const cpu_set_t* Cpus(size_t thread) const;
+
+	/// NUMA node of the thread with the given index, -1 if unknown.
+	int Node(size_t thread) const;
+
+	/**
+	 * Binds the calling thread to the CPUs of the thread with the given index.
+	 * Does nothing for an empty placement.
+	 */
+	void Apply(size_t thread) const;
+};
+
+/// Parses a list like "0-3,8". Returns false if it is malformed.
+bool parseCpuList(const std::string &list, std::vector<int> &result);
+
+/// NUMA node of a CPU, -1 if unknown.
+int cpuNode(int cpu);
+
+/**
+ * Asks the kernel to place the pages of a buffer on a NUMA node when they are
+ * first touched. Only whole pages inside the buffer are affected, so it should
+ * be called right after allocating and before writing to the buffer.
+ */
+void preferNode(void *buffer, size_t length, int node);
+
+/// Placement of the reader threads.
+extern ThreadPlacement readerPlacement;
+/// Placement of the writer threads.
+extern ThreadPlacement writerPlacement;
+/// Placement of the thread running the central scheduling loop.
+extern ThreadPlacement schedulerPlacement;
+
+#endif /* SRC_THREADPLACEMENT_H_ */
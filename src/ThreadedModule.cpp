@@ -1,5 +1,6 @@
 #include "ThreadedModule.h"
 
+#include <pthread.h>
 #include <cassert>
 
 using namespace std;
@@ -8,7 +9,7 @@ void ThreadedModule::onStop() {
 }
 
 ThreadedModule::ThreadedModule() :
-		itsThread(nullptr), stop(false) {
+		itsThread(nullptr), pinned(false), node(-1), stop(false) {
 }
 
 ThreadedModule::~ThreadedModule() {
@@ -16,9 +17,22 @@ ThreadedModule::~ThreadedModule() {
 	delete itsThread;
 }
 
+void ThreadedModule::main() {
+	if (pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	run();
+}
+
+void ThreadedModule::Pin(const cpu_set_t &cpus, int node) {
+	assert(itsThread == nullptr);
+	this->cpus = cpus;
+	this->node = node;
+	pinned = true;
+}
+
 void ThreadedModule::Start() {
 	assert(itsThread == nullptr);
-	itsThread = new thread(&ThreadedModule::run, this);
+	itsThread = new thread(&ThreadedModule::main, this);
 }
 
 void ThreadedModule::Stop() {
@@ -1,6 +1,7 @@
 #ifndef SRC_TOOLS_THREADEDMODULE_H_
 #define SRC_TOOLS_THREADEDMODULE_H_
 
+#include <sched.h>
 #include <thread>
 
 /**
@@ -8,6 +9,13 @@
  */
 class ThreadedModule {
 	std::thread* itsThread;
+	/// CPUs the thread is bound to, if pinned.
+	cpu_set_t cpus;
+	bool pinned;
+	int node;
+
+	/// Entry point of the thread.
+	void main();
 protected:
 	/// When this variable becomes true, the run method must stop.
 	volatile bool stop;
@@ -28,6 +36,17 @@ public:
 	 * Blocks until the thread of the module is not running (anymore).
 	 */
 	virtual ~ThreadedModule();
+	/**
+	 * Binds the module's thread to a set of CPUs. Must be called before Start.
+	 * @param node NUMA node of the CPUs, -1 if unknown.
+	 */
+	void Pin(const cpu_set_t &cpus, int node);
+	/**
+	 * NUMA node the module's thread runs on, -1 if unknown.
+	 */
+	int Node() const {
+		return node;
+	}
 	/**
 	 * Starts the module's thread.
 	 */
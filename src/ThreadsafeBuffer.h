@@ -34,6 +34,12 @@ public:
 	 * @param value Pointer to the object that should be enqueued in the buffer.
 	 */
 	inline void PushBack(Type*const& value);
+	/**
+	 * Adds a pointer to a new element to the buffer if it is not full.
+	 * @param value Pointer to the object that should be enqueued in the buffer.
+	 * @returns false if the buffer is full.
+	 */
+	inline bool TryPushBack(Type*const& value);
 	/**
 	 * Removes the oldest pointer from the buffer.
 	 * @remarks This method blocks until PushBack() is called from another
@@ -78,6 +84,21 @@ template<typename Type> void ThreadsafeBuffer<Type>::PushBack(
 	pthread_mutex_unlock(&bufferModified);
 }
 
+template<typename Type> bool ThreadsafeBuffer<Type>::TryPushBack(
+		Type*const& value) {
+	pthread_mutex_lock(&bufferModified);
+
+	bool result = buffer.size() < maxSize;
+	if (result) {
+		buffer.push_back(value);
+		pthread_cond_signal(&bufferModificationDone);
+	}
+
+	pthread_mutex_unlock(&bufferModified);
+
+	return result;
+}
+
 template<typename Type> Type* ThreadsafeBuffer<Type>::PopFront() {
 	pthread_mutex_lock(&bufferModified);
 
@@ -0,0 +1,265 @@
+#include "ThrottledBackend.h"
+
+#include "TokenBucket.h"
+
+#include <sys/stat.h>
+#include <csignal>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+static TokenBucket readBucket, writeBucket, metadataBucket;
+
+/// Control file, empty if there is none.
+static string controlFile;
+/// mtime of the control file when it was read last.
+static struct timespec controlFileMtime = { };
+/// Set by the SIGHUP handler.
+static atomic<bool> reloadRequested(false);
+/// Next time the control file is checked, as steady clock ticks.
+static atomic<int64_t> nextPoll(0);
+/// Only one thread checks the control file.
+static mutex pollMutex;
+/// Limits and share of this process, as last set.
+static ThrottledBackend::Limits currentLimits;
+static double currentShare = 1;
+static mutex limitsModified;
+
+ThrottledBackend::Limits::Limits() :
+		ReadBandwidth(0), WriteBandwidth(0), MetadataOps(0) {
+}
+
+bool ThrottledBackend::Limits::Parse(const string &spec) {
+	string list = spec;
+	replace_if(list.begin(), list.end(), [](char c) {
+		return isspace(c);
+	}, ',');
+	stringstream stream(list);
+	string item;
+	while (getline(stream, item, ',')) {
+		if (item.empty())
+			continue;
+		size_t equals = item.find('=');
+		if (equals == string::npos)
+			return false;
+		string key = item.substr(0, equals);
+		double value = strtod(item.c_str() + equals + 1, nullptr);
+		if (key == "read_mbps")
+			ReadBandwidth = value * 1024 * 1024;
+		else if (key == "write_mbps")
+			WriteBandwidth = value * 1024 * 1024;
+		else if (key == "meta_ops")
+			MetadataOps = value;
+		else
+			return false;
+	}
+	return true;
+}
+
+ThrottledBackend::ThrottledBackend(IoBackend *underlying) :
+		underlying(underlying) {
+}
+
+/// Sets the rates of the buckets. Must be called with limitsModified locked.
+static void applyLimits() {
+	readBucket.SetRate(currentLimits.ReadBandwidth * currentShare);
+	writeBucket.SetRate(currentLimits.WriteBandwidth * currentShare);
+	metadataBucket.SetRate(currentLimits.MetadataOps * currentShare);
+}
+
+void ThrottledBackend::SetLimits(const Limits &limits) {
+	lock_guard<mutex> lock(limitsModified);
+	currentLimits = limits;
+	applyLimits();
+}
+
+ThrottledBackend::Limits ThrottledBackend::GetLimits() {
+	lock_guard<mutex> lock(limitsModified);
+	return currentLimits;
+}
+
+void ThrottledBackend::SetShare(double share) {
+	lock_guard<mutex> lock(limitsModified);
+	currentShare = share;
+	applyLimits();
+}
+
+static void requestReload(int) {
+	reloadRequested = true;
+}
+
+void ThrottledBackend::Watch(const string &path) {
+	controlFile = path;
+	signal(SIGHUP, requestReload);
+	reloadRequested = true;
+	pollControlFile();
+}
+
+void ThrottledBackend::pollControlFile() {
+	if (controlFile.empty())
+		return;
+	int64_t now = chrono::steady_clock::now().time_since_epoch().count();
+	if (!reloadRequested && now < nextPoll)
+		return;
+	unique_lock<mutex> lock(pollMutex, try_to_lock);
+	if (!lock.owns_lock())
+		return;
+	nextPoll = now
+			+ chrono::duration_cast<chrono::steady_clock::duration>(
+					chrono::seconds(1)).count();
+
+	bool reload = reloadRequested.exchange(false);
+	struct stat fileStat;
+	if (stat(controlFile.c_str(), &fileStat) != 0)
+		return;
+	if (!reload && fileStat.st_mtim.tv_sec == controlFileMtime.tv_sec
+			&& fileStat.st_mtim.tv_nsec == controlFileMtime.tv_nsec)
+		return;
+	controlFileMtime = fileStat.st_mtim;
+
+	ifstream file(controlFile);
+	stringstream content;
+	content << file.rdbuf();
+	Limits limits;
+	if (!limits.Parse(content.str())) {
+		cerr << "Ignoring invalid throttle file " << controlFile << endl;
+		return;
+	}
+	SetLimits(limits);
+	cerr << "Throttle: read " << limits.ReadBandwidth / 1024 / 1024
+			<< " MB/s, write " << limits.WriteBandwidth / 1024 / 1024
+			<< " MB/s, metadata " << limits.MetadataOps
+			<< " ops/s (0 = unlimited)" << endl;
+}
+
+void ThrottledBackend::throttle(TokenBucket &bucket, double amount) {
+	pollControlFile();
+	while (!bucket.Acquire(amount, chrono::milliseconds(200)))
+		pollControlFile();
+}
+
+int ThrottledBackend::Stat(const DirHandle *dir, const string &name,
+		struct stat *buf, unsigned int mask) {
+	throttle(metadataBucket, 1);
+	return underlying->Stat(dir, name, buf, mask);
+}
+
+int ThrottledBackend::Fstat(int fd, struct stat *buf, unsigned int mask) {
+	throttle(metadataBucket, 1);
+	return underlying->Fstat(fd, buf, mask);
+}
+
+int ThrottledBackend::Open(const DirHandle *dir, const string &name,
+		int flags, mode_t mode) {
+	throttle(metadataBucket, 1);
+	return underlying->Open(dir, name, flags, mode);
+}
+
+int ThrottledBackend::Close(int fd) {
+	return underlying->Close(fd);
+}
+
+ssize_t ThrottledBackend::Pread(int fd, void *buf, size_t count,
+		off_t offset) {
+	throttle(readBucket, count);
+	return underlying->Pread(fd, buf, count, offset);
+}
+
+ssize_t ThrottledBackend::Write(int fd, const void *buf, size_t count) {
+	throttle(writeBucket, count);
+	return underlying->Write(fd, buf, count);
+}
+
+ssize_t ThrottledBackend::Pwrite(int fd, const void *buf, size_t count,
+		off_t offset) {
+	throttle(writeBucket, count);
+	return underlying->Pwrite(fd, buf, count, offset);
+}
+
+int ThrottledBackend::Truncate(int fd, off_t length) {
+	throttle(metadataBucket, 1);
+	return underlying->Truncate(fd, length);
+}
+
+ssize_t ThrottledBackend::ReadLink(const DirHandle *dir, const string &name,
+		char *buf, size_t size) {
+	throttle(metadataBucket, 1);
+	return underlying->ReadLink(dir, name, buf, size);
+}
+
+int ThrottledBackend::Symlink(const char *target, const DirHandle *dir,
+		const string &name) {
+	throttle(metadataBucket, 1);
+	return underlying->Symlink(target, dir, name);
+}
+
+int ThrottledBackend::Mkdir(const DirHandle *dir, const string &name,
+		mode_t mode) {
+	throttle(metadataBucket, 1);
+	return underlying->Mkdir(dir, name, mode);
+}
+
+int ThrottledBackend::SetTimes(const DirHandle *dir, const string &name,
+		const struct timespec times[2]) {
+	throttle(metadataBucket, 1);
+	return underlying->SetTimes(dir, name, times);
+}
+
+int ThrottledBackend::Chown(const DirHandle *dir, const string &name,
+		uid_t uid, gid_t gid) {
+	throttle(metadataBucket, 1);
+	return underlying->Chown(dir, name, uid, gid);
+}
+
+int ThrottledBackend::Chmod(const DirHandle *dir, const string &name,
+		mode_t mode) {
+	throttle(metadataBucket, 1);
+	return underlying->Chmod(dir, name, mode);
+}
+
+int ThrottledBackend::Futimens(int fd, const struct timespec times[2]) {
+	throttle(metadataBucket, 1);
+	return underlying->Futimens(fd, times);
+}
+
+int ThrottledBackend::Fchown(int fd, uid_t uid, gid_t gid) {
+	throttle(metadataBucket, 1);
+	return underlying->Fchown(fd, uid, gid);
+}
+
+int ThrottledBackend::Fchmod(int fd, mode_t mode) {
+	throttle(metadataBucket, 1);
+	return underlying->Fchmod(fd, mode);
+}
+
+bool ThrottledBackend::RemoveAll(const DirHandle *dir, const string &name) {
+	// Walk the tree through this backend such that every entry is charged
+	struct stat entryStat;
+	if (Stat(dir, name, &entryStat, STATX_TYPE) != 0)
+		return errno == ENOENT;
+	bool success = true;
+	if (S_ISDIR(entryStat.st_mode)) {
+		shared_ptr<DirHandle> subDir = OpenDirectory(dir, name);
+		vector<string> names;
+		success = ListDirectory(*subDir, names);
+		for (const string &entry : names)
+			success &= RemoveAll(subDir.get(), entry);
+	}
+	throttle(metadataBucket, 1);
+	return underlying->RemoveAll(dir, name) && success;
+}
+
+bool ThrottledBackend::ListDirectory(const DirHandle &dir,
+		vector<string> &names) {
+	throttle(metadataBucket, 1);
+	return underlying->ListDirectory(dir, names);
+}
@@ -0,0 +1,99 @@
+#ifndef SRC_THROTTLEDBACKEND_H_
+#define SRC_THROTTLEDBACKEND_H_
+
+#include "IoBackend.h"
+
+#include <string>
+#include <vector>
+
+class TokenBucket;
+
+/**
+ * Backend that limits the rate of the operations before passing them to an
+ * underlying backend. All instances share three token buckets: bytes read,
+ * bytes written and metadata operations (everything that is neither a read
+ * nor a write, except close). Recursive removals are charged per entry.
+ * The limits can be changed while running through a control file, which is
+ * reread when it changes or on SIGHUP.
+ */
+class ThrottledBackend: public IoBackend {
+public:
+	struct Limits {
+		/// Bytes/s read, 0 for unlimited.
+		double ReadBandwidth;
+		/// Bytes/s written, 0 for unlimited.
+		double WriteBandwidth;
+		/// Metadata operations/s, 0 for unlimited.
+		double MetadataOps;
+
+		Limits();
+
+		/**
+		 * Reads settings from a list of key=value pairs separated by commas
+		 * or whitespace with the keys read_mbps, write_mbps and meta_ops.
+		 * @returns false if the list contains an unknown key.
+		 */
+		bool Parse(const std::string &spec);
+	};
+
+	explicit ThrottledBackend(IoBackend *underlying);
+
+	/// Applies new limits to all instances.
+	static void SetLimits(const Limits &limits);
+	/// Limits set last, before the share is applied.
+	static Limits GetLimits();
+
+	/**
+	 * Lets this process use only a fraction of the limits, e.g. 1/N if N
+	 * processes share them. Also applies to limits read from the control file.
+	 */
+	static void SetShare(double share);
+
+	/**
+	 * Takes the limits from a control file from now on: it is read right away
+	 * (if it exists), whenever its mtime changes and when the process
+	 * receives SIGHUP.
+	 */
+	static void Watch(const std::string &path);
+
+	int Stat(const DirHandle *dir, const std::string &name, struct stat *buf,
+			unsigned int mask = StatMaskAttributes) override;
+	int Fstat(int fd, struct stat *buf, unsigned int mask = StatMaskAttributes)
+			override;
+	int Open(const DirHandle *dir, const std::string &name, int flags,
+			mode_t mode = 0) override;
+	int Close(int fd) override;
+	ssize_t Pread(int fd, void *buf, size_t count, off_t offset) override;
+	ssize_t Write(int fd, const void *buf, size_t count) override;
+	ssize_t Pwrite(int fd, const void *buf, size_t count, off_t offset)
+			override;
+	int Truncate(int fd, off_t length) override;
+	ssize_t ReadLink(const DirHandle *dir, const std::string &name, char *buf,
+			size_t size) override;
+	int Symlink(const char *target, const DirHandle *dir,
+			const std::string &name) override;
+	int Mkdir(const DirHandle *dir, const std::string &name, mode_t mode)
+			override;
+	int SetTimes(const DirHandle *dir, const std::string &name,
+			const struct timespec times[2]) override;
+	int Chown(const DirHandle *dir, const std::string &name, uid_t uid,
+			gid_t gid) override;
+	int Chmod(const DirHandle *dir, const std::string &name, mode_t mode)
+			override;
+	int Futimens(int fd, const struct timespec times[2]) override;
+	int Fchown(int fd, uid_t uid, gid_t gid) override;
+	int Fchmod(int fd, mode_t mode) override;
+	bool RemoveAll(const DirHandle *dir, const std::string &name) override;
+	bool ListDirectory(const DirHandle &dir, std::vector<std::string> &names)
+			override;
+
+private:
+	IoBackend *underlying;
+
+	/// Takes tokens from a bucket and keeps checking the control file meanwhile.
+	static void throttle(TokenBucket &bucket, double amount);
+	/// Rereads the control file if it changed or SIGHUP was received.
+	static void pollControlFile();
+};
+
+#endif /* SRC_THROTTLEDBACKEND_H_ */
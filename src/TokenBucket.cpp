@@ -0,0 +1,53 @@
+#include "TokenBucket.h"
+
+#include <algorithm>
+
+using namespace std;
+
+TokenBucket::TokenBucket() :
+		rate(0), tokens(0), lastRefill(Clock::now()) {
+}
+
+void TokenBucket::refill(Clock::time_point now) {
+	double elapsed = chrono::duration<double>(now - lastRefill).count();
+	tokens = min(rate, tokens + elapsed * rate);
+	lastRefill = now;
+}
+
+void TokenBucket::SetRate(double rate) {
+	lock_guard<mutex> lock(bucketModified);
+	refill(Clock::now());
+	// Coming from unlimited, start with a full bucket
+	tokens = this->rate <= 0 ? rate : min(tokens, rate);
+	this->rate = rate;
+	rateChanged.notify_all();
+}
+
+double TokenBucket::Rate() {
+	lock_guard<mutex> lock(bucketModified);
+	return rate;
+}
+
+bool TokenBucket::Acquire(double amount, chrono::milliseconds maxWait) {
+	unique_lock<mutex> lock(bucketModified);
+	Clock::time_point deadline = Clock::now() + maxWait;
+	while (true) {
+		if (rate <= 0)
+			return true;
+
+		Clock::time_point now = Clock::now();
+		refill(now);
+		double needed = min(amount, rate);
+		if (tokens >= needed) {
+			tokens -= amount;
+			return true;
+		}
+		if (now >= deadline)
+			return false;
+
+		Clock::time_point available = now
+				+ chrono::duration_cast<Clock::duration>(
+						chrono::duration<double>((needed - tokens) / rate));
+		rateChanged.wait_until(lock, min(available, deadline));
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef SRC_TOKENBUCKET_H_
+#define SRC_TOKENBUCKET_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * Limits the rate of some quantity (bytes, operations) over all threads.
+ * The bucket fills up with Rate tokens per second and holds at most the
+ * tokens of one second, which is the allowed burst.
+ */
+class TokenBucket {
+	typedef std::chrono::steady_clock Clock;
+
+	/// Tokens per second, 0 for unlimited.
+	double rate;
+	double tokens;
+	Clock::time_point lastRefill;
+	std::mutex bucketModified;
+	std::condition_variable rateChanged;
+
+	/// Adds the tokens which accumulated since the last refill.
+	void refill(Clock::time_point now);
+public:
+	TokenBucket();
+
+	/// Changes the rate. Waiting threads are reconsidered immediately.
+	void SetRate(double rate);
+	double Rate();
+
+	/**
+	 * Takes amount tokens out of the bucket. An amount bigger than the burst
+	 * is granted when the bucket is full and leaves it in debt.
+	 * @param maxWait How long to wait for the tokens at most.
+	 * @returns false if the tokens were not available within maxWait.
+	 */
+	bool Acquire(double amount, std::chrono::milliseconds maxWait);
+};
+
+#endif /* SRC_TOKENBUCKET_H_ */
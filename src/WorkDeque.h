@@ -0,0 +1,74 @@
+#ifndef SRC_WORKDEQUE_H_
+#define SRC_WORKDEQUE_H_
+
+#include <pthread.h>
+#include <deque>
+
+/**
+ * Double ended queue of work items owned by one thread. The owner pushes and
+ * pops at the back, other threads steal the oldest items from the front.
+ * Never blocks apart from the short critical sections.
+ */
+template<typename Type>
+class WorkDeque {
+	std::deque<Type*> items;
+
+	pthread_mutex_t itemsModified;
+
+public:
+	WorkDeque();
+	~WorkDeque();
+
+	/**
+	 * Adds an item at the owner's end.
+	 */
+	inline void PushBack(Type *const &value);
+	/**
+	 * Removes the newest item (to be called by the owner).
+	 * @returns nullptr if the deque is empty.
+	 */
+	inline Type* PopBack();
+	/**
+	 * Removes the oldest item (to be called by thieves).
+	 * @returns nullptr if the deque is empty.
+	 */
+	inline Type* Steal();
+};
+
+template<typename Type> WorkDeque<Type>::WorkDeque() {
+	pthread_mutex_init(&itemsModified, NULL);
+}
+
+template<typename Type> WorkDeque<Type>::~WorkDeque() {
+	pthread_mutex_destroy(&itemsModified);
+}
+
+template<typename Type> void WorkDeque<Type>::PushBack(Type *const &value) {
+	pthread_mutex_lock(&itemsModified);
+	items.push_back(value);
+	pthread_mutex_unlock(&itemsModified);
+}
+
+template<typename Type> Type* WorkDeque<Type>::PopBack() {
+	pthread_mutex_lock(&itemsModified);
+	Type *result = nullptr;
+	if (!items.empty()) {
+		result = items.back();
+		items.pop_back();
+	}
+	pthread_mutex_unlock(&itemsModified);
+	return result;
+}
+
+template<typename Type> Type* WorkDeque<Type>::Steal() {
+	pthread_mutex_lock(&itemsModified);
+	Type *result = nullptr;
+	if (!items.empty()) {
+		result = items.front();
+		items.pop_front();
+	}
+	pthread_mutex_unlock(&itemsModified);
+	return result;
+}
+
+#endif /* SRC_WORKDEQUE_H_ */
@@ -1,249 +1,250 @@
-#include "ThreadsafeBuffer.h"
-#include "Task.h"
-#include "Job.h"
-#include "ModReader.h"
-#include "ModWriter.h"
-
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-
+#include "CopyTree.h"
+#include "Coordinator.h"
+#include "SimulatedBackend.h"
+#include "ThrottledBackend.h"
+#include "CheckpointJournal.h"
+#include "HashLog.h"
+#include "ThreadPlacement.h"
+
+#include <chrono>
+#include <filesystem>
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
-#include <cerrno>
-#include <cstring>
-#include <filesystem>
-#include <unordered_set>
+#include <cstdlib>
+#include <memory>
 
 using namespace std;
 
-size_t chunkSize = 64 * 1024 * 1024;
-size_t readerThreads = 1;
-size_t writerThreads = 8;
-
-inline bool operator==(const timespec &t1, const timespec &t2) {
-	if (t1.tv_sec != t2.tv_sec)
-		return false;
-	if (t1.tv_nsec != t2.tv_nsec)
-		return false;
-	return true;
+extern size_t chunkSize;
+extern size_t readerThreads;
+extern size_t writerThreads;
+extern bool workStealing;
+extern SchedulingPolicy schedulingPolicy;
+extern VerifyMode verifyMode;
+extern bool printProgress;
+
+static void printUsage() {
+	cerr
+			<< "Usage: ./fastsync [OPTIONS] SOURCE DEST [#READERS [#WRITERS [CHUNK_SIZE_MB]]]"
+			<< endl
+			<< "       ./fastsync --worker=HOST:PORT" << endl
+			<< "Options:" << endl
+			<< "  --quiet              Only print the summary" << endl
+			<< "  --journal=FILE       Record written chunks (default DEST.fastsync-journal)"
+			<< endl
+			<< "  --no-journal         Do not record written chunks" << endl
+			<< endl
+			<< "  --resume             Continue the files an interrupted run has recorded"
+			<< endl
+			<< "  --verify[=direct]    Read every chunk back and rewrite it on a mismatch,"
+			<< endl
+			<< "                       with direct bypassing the page cache" << endl
+			<< "  --hash-log=FILE      Append the hash of every written chunk to FILE"
+			<< endl
+			<< "  --scheduler=MODE     central (default) or steal" << endl
+			<< "  --policy=POLICY      Task order of the central scheduler: path (default),"
+			<< endl
+			<< "                       lpt, small-first or balanced" << endl
+			<< "  --sim-source[=SPEC]  Simulate a parallel filesystem on the source side"
+			<< endl
+			<< "  --sim-dest[=SPEC]    Simulate a parallel filesystem on the destination side"
+			<< endl
+			<< "                       SPEC: meta_us,mds,data_us,client_mbps,stripe_kb,servers,server_mbps"
+			<< endl
+			<< "  --reader-affinity=P  Bind readers to node:LIST or cpu:LIST (e.g. node:0)"
+			<< endl
+			<< "  --writer-affinity=P  Bind writers to node:LIST or cpu:LIST (e.g. cpu:8-15)"
+			<< endl
+			<< "  --scheduler-affinity=P Bind the scheduling thread to node:LIST or cpu:LIST"
+			<< endl
+			<< "  --throttle=SPEC      Limit the rates, SPEC: read_mbps,write_mbps,meta_ops"
+			<< endl
+			<< "  --throttle-file=FILE Reread the limits from FILE when it changes or on SIGHUP"
+			<< endl
+			<< "  --workers=N          Copy with N local worker processes" << endl
+			<< "  --listen=HOST:PORT   Also accept remote workers" << endl
+			<< "  --split-depth=N      Directory levels split into partitions (default 1)"
+			<< endl
+			<< "  --bucket-mb=N        Files of at least N MB get a partition of their own"
+			<< endl
+			<< "  --bucket-entries=N   Small entries bundled per partition"
+			<< endl;
 }
 
-inline bool operator!=(const timespec &t1, const timespec &t2) {
-	return !(t1 == t2);
-}
-
-void copyTree(const char *pathIn, const char *pathOut) {
-	// == Initialize Pipeline ==
-
-	// Buffers
-	ThreadsafeBuffer<Task> TasksOpen(max(readerThreads, writerThreads) * 2);
-	ThreadsafeBuffer<Task> TasksRead(max(readerThreads, writerThreads) * 2);
-	ThreadsafeBuffer<Task> TasksWritten(max(readerThreads, writerThreads) * 2);
-
-	// Readers
-	vector<ModReader*> readers;
-	for (size_t r = 0; r < readerThreads; r++) {
-		ModReader *modReader = new ModReader();
-		modReader->In = &TasksOpen;
-		modReader->Out = &TasksRead;
-		modReader->Start();
-		readers.push_back(modReader);
-	}
-
-	// Writers
-	vector<ModWriter*> writers;
-	for (size_t w = 0; w < writerThreads; w++) {
-		ModWriter *modWriter = new ModWriter();
-		modWriter->In = &TasksRead;
-		modWriter->Out = &TasksWritten;
-		modWriter->Start();
-		writers.push_back(modWriter);
-	}
-
-	// == Processing loop ==
-
-	struct JobPtrCompare {
-		bool operator() (const Job* lhs, const Job* rhs) const {
-			// Special case: If nullptrs are involved, they are always smaller
-			if(lhs == nullptr && rhs == nullptr)
-				return false;
-			if(lhs == nullptr)
-				return true;
-			if(rhs == nullptr)
-				return false;
-
-			// Both are not nullptr -> sequence id is most significant
-			if(lhs->SourcePath < rhs->SourcePath)
-				return true;
-			if(lhs->SourcePath >= rhs->SourcePath)
-				return false;
-
-			if(lhs < rhs)
-				return true;
-			return false;
+int main(int argc, char **argv) {
+	CoordinatorConfig coordinatorConfig;
+	string workerEndpoint;
+	vector<string> positional;
+	unique_ptr<IoBackend> simulatedSource, simulatedDest;
+	unique_ptr<IoBackend> throttledSource, throttledDest;
+	ThrottledBackend::Limits limits;
+	string throttleFile;
+	bool throttle = false;
+	string journalPath;
+	bool resume = false;
+	bool noJournal = false;
+	string hashLogPath;
+
+	for (int a = 1; a < argc; a++) {
+		string arg = argv[a];
+		if (arg.compare(0, 2, "--") != 0) {
+			positional.push_back(arg);
+			continue;
 		}
-	};
-
-	// All jobs that are currently in flight
-	std::set<Job*, JobPtrCompare> jobsOpen;
-
-	// Insert root as first open job
-	Job *rootJob = new Job();
-	rootJob->SourcePath = pathIn;
-	rootJob->DestPath = pathOut;
-	jobsOpen.insert(rootJob);
-
-	while (jobsOpen.size() > 0) {
-		// Try to create new jobs from finished tasks
-		if (TasksWritten.Size() > 0) {
-			Task *task = TasksWritten.PopFront();
-			if (task->Type == Task::TaskType::INIT) {
-				cout << jobsOpen.size() << " I " << task->ItsJob->SourcePath
-						<< endl;
-
-				// If this was a directory task
-				if (S_ISDIR(task->ItsJob->SourceStat.st_mode)) {
-					// Start jobs for subdirectories and create dependencies
-					for (const auto &entry : filesystem::directory_iterator(
-							task->ItsJob->SourcePath)) {
-						Job *subJob = new Job();
-						subJob->SourcePath = task->ItsJob->SourcePath
-								/ entry.path().filename();
-						subJob->DestPath = task->ItsJob->DestPath
-								/ entry.path().filename();
-						createDependency(task->ItsJob, subJob);
-						jobsOpen.insert(subJob);
-					}
-				}
-				task->ItsJob->InitState = Job::CopyState::DONE;
-
-				// For links and files, check if copy has to continue at all
-				if ((S_ISREG(task->ItsJob->DestStat.st_mode)
-						|| S_ISLNK(task->ItsJob->DestStat.st_mode))
-						&& task->ItsJob->DestStat.st_size
-								== task->ItsJob->SourceStat.st_size
-						&& task->ItsJob->DestStat.st_mtim.tv_sec
-								== task->ItsJob->SourceStat.st_mtim.tv_sec
-						&& task->ItsJob->DestStat.st_uid
-								== task->ItsJob->SourceStat.st_uid
-						&& task->ItsJob->DestStat.st_gid
-								== task->ItsJob->SourceStat.st_gid) {
-					// Remove this job's dependencies
-					while (task->ItsJob->Dependents.size() > 0) {
-						removeDependency(*task->ItsJob->Dependents.begin(),
-								task->ItsJob);
-					}
-
-					jobsOpen.erase(task->ItsJob);
-					delete task->ItsJob;
-				}
+		size_t equals = arg.find('=');
+		string key = arg.substr(2, equals - 2);
+		string value = equals == string::npos ? "" : arg.substr(equals + 1);
+		if (key == "quiet")
+			printProgress = false;
+		else if (key == "journal")
+			journalPath = value;
+		else if (key == "resume")
+			resume = true;
+		else if (key == "no-journal")
+			noJournal = true;
+		else if (key == "verify" && (value.empty() || value == "direct"))
+			verifyMode = value.empty() ? VerifyMode::CACHED : VerifyMode::DIRECT;
+		else if (key == "hash-log")
+			hashLogPath = value;
+		else if (key == "scheduler" && (value == "central" || value == "steal"))
+			workStealing = value == "steal";
+		else if (key == "policy") {
+			if (!parseSchedulingPolicy(value, schedulingPolicy)) {
+				cerr << "Unknown policy " << value << endl;
+				return -1;
 			}
-			if (task->Type == Task::TaskType::CHUNK) {
-				cout << jobsOpen.size() << " C" << task->ChunkIdx << " "
-						<< task->ItsJob->SourcePath << endl;
-				task->ItsJob->ChunkState[task->ChunkIdx] = Job::CopyState::DONE;
+		} else if (key == "sim-source" || key == "sim-dest") {
+			SimulatedBackend::Config simConfig;
+			if (!simConfig.Parse(value)) {
+				cerr << "Invalid simulation settings " << value << endl;
+				return -1;
 			}
-			if (task->Type == Task::TaskType::ATTRIBUTES) {
-				cout << jobsOpen.size() << " A " << task->ItsJob->SourcePath
-						<< endl;
-				// Remove this job's dependencies
-				while (task->ItsJob->Dependents.size() > 0) {
-					removeDependency(*task->ItsJob->Dependents.begin(),
-							task->ItsJob);
-				}
-				//Mark attributes as finished (not really necessary because job will be deleted immediatelly)
-				task->ItsJob->AttribState = Job::CopyState::DONE;
-				// Delete the job
-				jobsOpen.erase(task->ItsJob);
-				delete task->ItsJob;
+			if (key == "sim-source") {
+				simulatedSource.reset(new SimulatedBackend(sourceBackend, simConfig));
+				sourceBackend = simulatedSource.get();
+			} else {
+				simulatedDest.reset(new SimulatedBackend(destBackend, simConfig));
+				destBackend = simulatedDest.get();
 			}
-
-			delete task;
-			continue;
-		}
-
-		// Try to continue on an open job
-		for (Job *job : jobsOpen) {
-			// Check for init - can always be done
-			if (job->InitState == Job::CopyState::OPEN) {
-				job->InitState = Job::CopyState::SCHEDULED;
-				TasksOpen.PushBack(new Task(Task::TaskType::INIT, job));
-				break;
+		} else if (key == "reader-affinity" || key == "writer-affinity"
+				|| key == "scheduler-affinity") {
+			ThreadPlacement &placement =
+					key == "reader-affinity" ? readerPlacement :
+					key == "writer-affinity" ?
+							writerPlacement : schedulerPlacement;
+			if (!placement.Parse(value)) {
+				cerr << "Invalid placement " << value << endl;
+				return -1;
 			}
-
-			// Check for chunk - can be done if init is finished
-			bool allChunksWritten = true;
-			if (job->InitState == Job::CopyState::DONE) {
-				bool openChunkFound = false;
-				for (size_t c = 0; c < job->ChunkState.size(); c++) {
-					bool prevChunksWritten = allChunksWritten;
-					if (job->ChunkState[c] != Job::CopyState::DONE)
-						allChunksWritten = false;
-					if (prevChunksWritten
-							&& job->ChunkState[c] == Job::CopyState::OPEN) {
-						job->ChunkState[c] = Job::CopyState::SCHEDULED;
-						TasksOpen.PushBack(
-								new Task(Task::TaskType::CHUNK, job, c));
-						openChunkFound = true;
-						break;
-					}
-				}
-				if (openChunkFound)
-					break;
-			}
-
-			// Check for attributes - can be done if all chonks are written and there are no dependencies
-			if (job->InitState == Job::CopyState::DONE && allChunksWritten
-					&& job->AttribState == Job::CopyState::OPEN
-					&& job->FinishDirDependencies.size() == 0) {
-				job->AttribState = Job::CopyState::SCHEDULED;
-				TasksOpen.PushBack(new Task(Task::TaskType::ATTRIBUTES, job));
-				break;
+		} else if (key == "throttle") {
+			if (!limits.Parse(value)) {
+				cerr << "Invalid throttle settings " << value << endl;
+				return -1;
 			}
+			throttle = true;
+		} else if (key == "throttle-file") {
+			throttleFile = value;
+			throttle = true;
+		} else if (key == "workers")
+			coordinatorConfig.LocalWorkers = atoi(value.c_str());
+		else if (key == "listen")
+			coordinatorConfig.Listen = value;
+		else if (key == "split-depth")
+			coordinatorConfig.SplitDepth = atoi(value.c_str());
+		else if (key == "bucket-mb")
+			coordinatorConfig.BucketBytes = atoll(value.c_str()) * 1024 * 1024;
+		else if (key == "bucket-entries")
+			coordinatorConfig.BucketEntries = atoi(value.c_str());
+		else if (key == "worker")
+			workerEndpoint = value;
+		else {
+			cerr << "Unknown option " << arg << endl;
+			printUsage();
+			return -1;
 		}
 	}
 
-	// == Cleanup ==
+	// Keep a journal by default such that any interrupted run can be resumed.
+	// It is placed next to DEST, where pruning DEST cannot delete it. The
+	// root directory has no such place.
+	if (journalPath.empty() && !noJournal && positional.size() >= 2) {
+		filesystem::path dest =
+				filesystem::absolute(positional[1]).lexically_normal();
+		if (!dest.has_filename())
+			dest = dest.parent_path();
+		if (dest.has_filename())
+			journalPath = (dest.parent_path()
+					/ (dest.filename().string() + ".fastsync-journal")).string();
+	}
+	if (noJournal) {
+		if (resume) {
+			cerr << "--resume needs a journal" << endl;
+			return -1;
+		}
+		journalPath.clear();
+	}
+	unique_ptr<CheckpointJournal> checkpointJournal;
+	if (!journalPath.empty()) {
+		checkpointJournal.reset(new CheckpointJournal());
+		if (!checkpointJournal->Open(journalPath, resume)) {
+			cerr << "Could not open journal " << journalPath << endl;
+			return -1;
+		}
+		journal = checkpointJournal.get();
+	}
 
-	assert(TasksOpen.Size() == 0);
-	assert(TasksRead.Size() == 0);
-	assert(TasksWritten.Size() == 0);
+	unique_ptr<HashLog> chunkHashLog;
+	if (!hashLogPath.empty()) {
+		chunkHashLog.reset(new HashLog());
+		if (!chunkHashLog->Open(hashLogPath)) {
+			cerr << "Could not open hash log " << hashLogPath << endl;
+			return -1;
+		}
+		hashLog = chunkHashLog.get();
+	}
 
-	// Readers
-	for (ModReader *reader : readers)
-		reader->Stop();
-	for (ModReader *reader : readers)
-		TasksOpen.PushBack(nullptr);
-	for (ModReader *reader : readers)
-		delete reader;
+	// Limit the operations of both sides (on top of a simulation). Workers
+	// may also get limits from their coordinator.
+	if (throttle || !workerEndpoint.empty()) {
+		throttledSource.reset(new ThrottledBackend(sourceBackend));
+		sourceBackend = throttledSource.get();
+		throttledDest.reset(new ThrottledBackend(destBackend));
+		destBackend = throttledDest.get();
+		ThrottledBackend::SetLimits(limits);
+		if (!throttleFile.empty())
+			ThrottledBackend::Watch(throttleFile);
+	}
 
-	// Writers
-	for (ModWriter *writer : writers)
-		writer->Stop();
-	for (ModWriter *writer : writers)
-		TasksRead.PushBack(nullptr);
-	for (ModWriter *writer : writers)
-		delete writer;
+	// Every open directory of the tree holds a descriptor
+	raiseDescriptorLimit();
 
-}
+	if (!workerEndpoint.empty())
+		return runWorker(workerEndpoint);
 
-int main(int argc, char **argv) {
-	if (argc < 3) {
-		cerr
-				<< "Usage: ./fastsync SOURCE DEST [#READERS [#WRITERS [CHUNK_SIZE_MB]]]"
-				<< endl;
+	if (positional.size() < 2) {
+		printUsage();
 		return -1;
 	}
 
-	if (argc >= 4)
-		readerThreads = atoi(argv[3]);
-	if (argc >= 5)
-		writerThreads = atoi(argv[4]);
-	if (argc >= 6)
-		chunkSize = atoi(argv[5]) * 1024 * 1024;
-
-	copyTree(argv[1], argv[2]);
+	if (positional.size() >= 3)
+		readerThreads = atoi(positional[2].c_str());
+	if (positional.size() >= 4)
+		writerThreads = atoi(positional[3].c_str());
+	if (positional.size() >= 5)
+		chunkSize = atoi(positional[4].c_str()) * 1024 * 1024;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	Summary summary;
+	if (coordinatorConfig.LocalWorkers > 0 || !coordinatorConfig.Listen.empty())
+		summary = runCoordinator(positional[0], positional[1],
+				coordinatorConfig);
+	else
+		summary = copyTree(positional[0], positional[1]);
+
+	summary.Print(cout);
+	cout << "seconds: "
+			<< chrono::duration<double>(chrono::steady_clock::now() - start).count()
+			<< endl;
+	return summary.Errors() == 0 ? 0 : 1;
 }